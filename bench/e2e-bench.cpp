@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: Apache-2.0
+
+// End-to-end benchmark: runs agl-service-monitor against a local mock
+// KUKSA.val server, pushes notifications at a fixed rate and captures
+// the resulting frames on a vcan interface.  Every signal has its own
+// frame and the value is a sequence number, so each frame is matched to
+// the notification it came from.
+//
+// Needs a vcan interface:
+//   ip link add dev vcan0 type vcan && ip link set up vcan0
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/program_options.hpp>
+#include "latency-histogram.hpp"
+#include "mock-vis-server.hpp"
+#include "self-signed-cert.hpp"
+
+namespace po = boost::program_options;
+namespace fs = std::filesystem;
+
+extern char **environ;
+
+// Exit code for skipped tests and benchmarks
+#define EXIT_SKIP 77
+#define BASE_CAN_ID 0x100
+// Values cycle through this many sequence numbers per signal
+#define SEQUENCE_RANGE 4096
+
+struct Options
+{
+	std::string service;
+	std::string interface;
+	unsigned signals;
+	unsigned rate;
+	unsigned duration;
+	unsigned warmup;
+	bool can_thread;
+	bool branch;
+};
+
+static std::string path_of(unsigned signal)
+{
+	return "Bench.Signal" + std::to_string(signal);
+}
+
+static bool write_config(const fs::path &dir, const Options &options, unsigned short port)
+{
+	fs::create_directories(dir / "AGL");
+	std::ofstream token(dir / "token");
+	token << "bench" << std::endl;
+
+	std::ofstream config(dir / "AGL" / "agl-service-monitor.conf");
+	config << "[vis-client]\n"
+	       << "server=127.0.0.1\n"
+	       << "port=" << port << "\n"
+	       << "key=" << (dir / "key.pem").string() << "\n"
+	       << "certificate=" << (dir / "cert.pem").string() << "\n"
+	       << "ca-certificate=" << (dir / "cert.pem").string() << "\n"
+	       << "authorization=" << (dir / "token").string() << "\n"
+	       << "verbose=0\n"
+	       << (options.branch ? "branches=Bench.*\n" : "")
+	       << "\n[can]\n"
+	       << "port=" << options.interface << "\n"
+	       << "verbose=0\n"
+	       << "thread=" << (options.can_thread ? "true" : "false") << "\n";
+	for (unsigned i = 0; i < options.signals; i++) {
+		std::ostringstream id;
+		id << "0x" << std::hex << BASE_CAN_ID + i;
+		config << "\n[frame:bench" << i << "]\n"
+		       << "id=" << id.str() << "\n"
+		       << "dlc=2\n"
+		       << "\n[signal:bench" << i << "]\n"
+		       << "path=" << path_of(i) << "\n"
+		       << "frame=" << id.str() << "\n"
+		       << "start-bit=0\n"
+		       << "length=16\n";
+	}
+	return static_cast<bool>(config);
+}
+
+static pid_t spawn_service(const Options &options, const fs::path &dir)
+{
+	std::vector<std::string> env_strings;
+	for (char **env = environ; *env; env++) {
+		if (strncmp(*env, "XDG_CONFIG_HOME=", 16) && strncmp(*env, "JOURNAL_STREAM=", 15))
+			env_strings.push_back(*env);
+	}
+	env_strings.push_back("XDG_CONFIG_HOME=" + dir.string());
+	std::vector<char*> envp;
+	for (auto &env : env_strings)
+		envp.push_back(env.data());
+	envp.push_back(nullptr);
+
+	std::string log = (dir / "service.log").string();
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+	std::string service = options.service;
+	char *argv[] = { service.data(), nullptr };
+	pid_t pid;
+	int error = posix_spawn(&pid, service.c_str(), &actions, nullptr, argv, envp.data());
+	posix_spawn_file_actions_destroy(&actions);
+	return error ? -1 : pid;
+}
+
+// User plus system CPU time of a process in microseconds
+static uint64_t cpu_time(pid_t pid)
+{
+	std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+	std::string line;
+	std::getline(stat, line);
+	// Fields after the parenthesized command name, utime and stime are
+	// the 14th and 15th of the whole line
+	std::istringstream fields(line.substr(line.rfind(')') + 2));
+	std::string field;
+	uint64_t utime = 0, stime = 0;
+	for (int i = 3; i <= 15 && fields >> field; i++) {
+		if (i == 14)
+			utime = std::stoull(field);
+		if (i == 15)
+			stime = std::stoull(field);
+	}
+	return (utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+static int open_capture(const Options &options)
+{
+	int fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+	if (fd < 0)
+		return -1;
+
+	// Standard frames 0x100 to 0x1ff
+	struct can_filter filter = { BASE_CAN_ID, (CAN_SFF_MASK & ~0xffU) | CAN_EFF_FLAG | CAN_RTR_FLAG };
+	setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+	struct timeval timeout = { 0, 100000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	int size = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	struct sockaddr_can addr = {};
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(options.interface.c_str());
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	po::options_description description("Options");
+	description.add_options()
+		("help", "Show this help")
+		("service", po::value(&options.service)->required(), "agl-service-monitor executable")
+		("interface", po::value(&options.interface)->default_value("vcan0"), "vcan interface")
+		("signals", po::value(&options.signals)->default_value(16), "Number of signals")
+		("rate", po::value(&options.rate)->default_value(1000), "Notifications per second over all signals")
+		("duration", po::value(&options.duration)->default_value(10), "Seconds to measure")
+		("warmup", po::value(&options.warmup)->default_value(1), "Seconds before measuring")
+		("can-thread", po::bool_switch(&options.can_thread), "Run the service's CAN I/O on its own thread")
+		("branch", po::bool_switch(&options.branch), "Subscribe to all signals with one branch subscription");
+	po::positional_options_description positional;
+	positional.add("service", 1);
+
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), vm);
+		if (vm.count("help")) {
+			std::cout << "Usage: " << argv[0] << " [options] <service>\n" << description;
+			return 0;
+		}
+		po::notify(vm);
+	}
+	catch (std::exception &ex) {
+		std::cerr << ex.what() << std::endl;
+		return 1;
+	}
+	if (options.signals == 0 || options.signals > 0x100 || options.rate == 0 || options.duration == 0) {
+		std::cerr << "Use 1 to 256 signals, and a non-zero rate and duration" << std::endl;
+		return 1;
+	}
+
+	if (!if_nametoindex(options.interface.c_str())) {
+		std::cerr << options.interface << " not found, create it with" << std::endl
+			  << "  ip link add dev " << options.interface << " type vcan && ip link set up "
+			  << options.interface << std::endl;
+		return EXIT_SKIP;
+	}
+	int capture = open_capture(options);
+	if (capture < 0) {
+		std::cerr << "Could not capture on " << options.interface << std::endl;
+		return EXIT_SKIP;
+	}
+
+	char dir_template[] = "/tmp/agl-monitor-bench.XXXXXX";
+	if (!mkdtemp(dir_template)) {
+		std::cerr << "Could not create a temporary directory" << std::endl;
+		return 1;
+	}
+	fs::path dir(dir_template);
+	if (!write_self_signed_cert((dir / "key.pem").string(), (dir / "cert.pem").string())) {
+		std::cerr << "Could not generate a certificate" << std::endl;
+		return 1;
+	}
+
+	// Mock server on its own thread
+	net::io_context ioc;
+	ssl::context ctx{ssl::context::tlsv12_server};
+	ctx.use_certificate_chain_file((dir / "cert.pem").string());
+	ctx.use_private_key_file((dir / "key.pem").string(), ssl::context::pem);
+	MockVisServer server(ioc, ctx);
+	auto work = net::make_work_guard(ioc);
+	std::thread server_thread([&ioc]() { ioc.run(); });
+
+	if (!write_config(dir, options, server.port())) {
+		std::cerr << "Could not write the configuration" << std::endl;
+		return 1;
+	}
+
+	// Send time per signal and sequence number, cleared when matched
+	std::vector<std::atomic<int64_t>> sent(options.signals * SEQUENCE_RANGE);
+	LatencyHistogram latency;
+	std::atomic<int64_t> measure_start{INT64_MAX};
+	std::atomic<uint64_t> frames{0};
+	std::atomic<bool> capturing{true};
+
+	std::thread capture_thread([&]() {
+		struct can_frame frame;
+		while (capturing.load(std::memory_order_relaxed)) {
+			if (read(capture, &frame, sizeof(frame)) != sizeof(frame))
+				continue;
+			int64_t now = monotonic_ns();
+			unsigned signal = frame.can_id - BASE_CAN_ID;
+			if (signal >= options.signals || frame.can_dlc < 2)
+				continue;
+			unsigned sequence = (frame.data[0] | frame.data[1] << 8) % SEQUENCE_RANGE;
+			int64_t time = sent[signal * SEQUENCE_RANGE + sequence].exchange(0, std::memory_order_relaxed);
+			if (time == 0 || time < measure_start.load(std::memory_order_relaxed))
+				continue;
+			latency.record((now - time) / 1000);
+			frames.fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	auto shutdown = [&]() {
+		capturing = false;
+		capture_thread.join();
+		work.reset();
+		ioc.stop();
+		server_thread.join();
+		close(capture);
+	};
+
+	auto spawned = std::chrono::steady_clock::now();
+	pid_t pid = spawn_service(options, dir);
+	if (pid < 0) {
+		std::cerr << "Could not start " << options.service << std::endl;
+		shutdown();
+		return 1;
+	}
+
+	int status = 0;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	std::size_t wanted = options.branch ? 1 : options.signals;
+	while (server.subscriptions() < wanted) {
+		if (std::chrono::steady_clock::now() > deadline || waitpid(pid, &status, WNOHANG) == pid) {
+			std::cerr << "Service did not subscribe, see " << (dir / "service.log").string() << std::endl;
+			kill(pid, SIGTERM);
+			waitpid(pid, &status, 0);
+			shutdown();
+			return 1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	auto subscribed = std::chrono::steady_clock::now();
+
+	// Notifications go out in 1 ms ticks, round robin over the signals
+	std::vector<std::string> paths;
+	for (unsigned i = 0; i < options.signals; i++)
+		paths.push_back(path_of(i));
+	std::vector<unsigned> sequences(options.signals, 0);
+	std::atomic<uint64_t> notifications{0};
+	uint64_t posted = 0;
+	unsigned next_signal = 0;
+	uint64_t cpu_start = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	auto measure = start + std::chrono::seconds(options.warmup);
+	auto end = measure + std::chrono::seconds(options.duration);
+	auto tick = start;
+	bool measuring = false;
+	while ((tick += std::chrono::milliseconds(1)) < end) {
+		std::this_thread::sleep_until(tick);
+		if (!measuring && tick >= measure) {
+			measuring = true;
+			cpu_start = cpu_time(pid);
+			measure_start.store(monotonic_ns(), std::memory_order_relaxed);
+		}
+
+		double elapsed = std::chrono::duration<double>(tick - start).count();
+		uint64_t due = static_cast<uint64_t>(elapsed * options.rate);
+		if (due <= posted)
+			continue;
+		unsigned count = due - posted;
+		posted = due;
+
+		unsigned first = next_signal;
+		next_signal = (next_signal + count) % options.signals;
+		net::post(ioc, [&, first, count, measuring]() {
+			for (unsigned i = 0; i < count; i++) {
+				unsigned signal = (first + i) % options.signals;
+				unsigned sequence = sequences[signal]++ % SEQUENCE_RANGE;
+				sent[signal * SEQUENCE_RANGE + sequence].store(monotonic_ns(), std::memory_order_relaxed);
+				if (server.notify(paths[signal], std::to_string(sequence)) && measuring)
+					notifications.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+	uint64_t cpu = cpu_time(pid) - cpu_start;
+
+	// Let the last frames arrive
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+	shutdown();
+
+	uint64_t sent_count = notifications.load();
+	uint64_t received = frames.load();
+	std::cout << std::fixed << std::setprecision(1)
+		  << "signals        " << options.signals << (options.can_thread ? " (CAN thread)" : "")
+		  << (options.branch ? " (branch subscription)" : "") << "\n"
+		  << "startup        " << std::chrono::duration<double, std::milli>(subscribed - spawned).count()
+		  << " ms to subscribe\n"
+		  << "notifications  " << sent_count << " at " << options.rate << "/s\n"
+		  << "frames         " << received << ", " << (sent_count > received ? sent_count - received : 0)
+		  << " conflated or lost\n"
+		  << "throughput     " << received / static_cast<double>(options.duration) << " frames/s\n"
+		  << "cpu            " << (sent_count ? static_cast<double>(cpu) / sent_count : 0.0)
+		  << " us/notification, " << 100.0 * cpu / (options.duration * 1000000.0) << "% of a core\n"
+		  << "latency (us)   p50 " << latency.quantile(0.5)
+		  << "  p90 " << latency.quantile(0.9)
+		  << "  p99 " << latency.quantile(0.99)
+		  << "  p99.9 " << latency.quantile(0.999)
+		  << "  max " << latency.max() << std::endl;
+
+	fs::remove_all(dir);
+	return 0;
+}
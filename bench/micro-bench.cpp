@@ -0,0 +1,380 @@
+// SPDX-License-Identifier: Apache-2.0
+
+// Microbenchmarks of the VIS message and CAN encoding hot paths.  Each
+// benchmark also reports the heap allocations per iteration.
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <benchmark/benchmark.h>
+#include <boost/property_tree/ini_parser.hpp>
+#include "monitor-service.hpp"
+#include "can-tx-scheduler.hpp"
+#include "handler-allocator.hpp"
+
+namespace fs = std::filesystem;
+
+// Counts every allocation made through operator new.  The operators
+// are kept out of line, GCC otherwise warns about free() on memory from
+// operator new once they are inlined into their callers.
+static std::atomic<uint64_t> g_allocations{0};
+
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+// Reports allocations per iteration for the scope of a benchmark run
+class AllocationCounter
+{
+	benchmark::State &m_state;
+	uint64_t m_start;
+
+public:
+	explicit AllocationCounter(benchmark::State &state) :
+		m_state(state),
+		m_start(g_allocations.load(std::memory_order_relaxed))
+	{
+	}
+
+	~AllocationCounter()
+	{
+		uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - m_start;
+		m_state.counters["allocs"] = benchmark::Counter(static_cast<double>(allocations),
+								benchmark::Counter::kAvgIterations);
+	}
+};
+
+// Messages as sent by KUKSA.val
+static const std::string NOTIFICATION =
+	R"({"action":"subscription","subscriptionId":"7f1c5a0e-3b6d-4f8e-9a2c-1d4b6e8f0a21",)"
+	R"("ts":"2024-03-14T09:26:53.589793Z","data":{"path":"Vehicle.Speed",)"
+	R"("dp":{"value":"87.5","ts":"2024-03-14T09:26:53.589653Z"}}})";
+static const std::string NOTIFICATION_NUMBER =
+	R"({"action":"subscription","subscriptionId":"3e9a7d21-5c4b-4a8f-b6e2-0f1d2c3b4a59",)"
+	R"("ts":"2024-03-14T09:26:53.590012Z","data":{"path":"Vehicle.TurboCharger.BoostLevel",)"
+	R"("dp":{"value":42,"ts":"2024-03-14T09:26:53.589981Z"}}})";
+static const std::string GET_RESPONSE =
+	R"({"action":"get","requestId":"17","ts":"2024-03-14T09:26:53.591203Z",)"
+	R"("data":{"path":"Vehicle.Speed","dp":{"value":"87.5","ts":"2024-03-14T09:26:53.589653Z"}}})";
+
+// Exposes the protected hot path entry points
+class BenchService : public MonitorService
+{
+public:
+	using MonitorService::MonitorService;
+	using VisSession::handle_decoded;
+	using VisSession::handle_message;
+	using VisSession::parseData;
+	using MonitorService::handle_authorized_response;
+	using MonitorService::handle_notification;
+
+	VisSignalId signal(std::string_view path) const { return m_signals.find(path); };
+
+	// As if the server had answered the subscription requests
+	void bind_subscription(std::string_view path, std::string_view subscriptionId)
+	{
+		m_signals.bind_subscription(m_signals.find(path), subscriptionId);
+	};
+};
+
+// A service with a small signal mapping, not connected to anything.  The
+// CAN interface does not exist, frames are assembled but not written.
+struct Fixture
+{
+	fs::path dir;
+	net::io_context ioc;
+	ssl::context ctx{ssl::context::tlsv12_client};
+	std::shared_ptr<BenchService> service;
+
+	Fixture() : dir(fs::temp_directory_path() / "agl-monitor-micro-bench")
+	{
+		fs::create_directories(dir / "AGL");
+		std::ofstream config(dir / "AGL" / "agl-service-monitor.conf");
+		config << "[can]\n"
+		       << "port=bench-none\n"
+		       << "verbose=0\n"
+		       << "\n[frame:speed]\nid=0x100\ndlc=8\n"
+		       << "\n[signal:speed]\npath=Vehicle.Speed\nframe=0x100\n"
+		       << "start-bit=0\nlength=16\nfactor=0.01\nmin=0\nmax=300\n"
+		       << "\n[frame:boost]\nid=0x201\ndlc=8\ndata=00 00 00 00 0B AD CA 78\n"
+		       << "\n[signal:boost-gauge]\npath=Vehicle.TurboCharger.BoostLevel\nframe=0x201\n"
+		       << "start-bit=8\nlength=8\nmin=0\nmax=99\ntable=0:50,79:129,80:170,100:210\n"
+		       << "\n[signal:boost-level]\npath=Vehicle.TurboCharger.BoostLevel\nframe=0x201\n"
+		       << "start-bit=24\nlength=8\nmin=0\nmax=99\n";
+		config.close();
+		setenv("XDG_CONFIG_HOME", dir.c_str(), 1);
+
+		VisConfig vis_config("localhost", 8090, "", "", "", "");
+		service = std::make_shared<BenchService>(vis_config, ioc, ctx);
+		service->handle_authorized_response();
+		service->bind_subscription("Vehicle.Speed", "7f1c5a0e-3b6d-4f8e-9a2c-1d4b6e8f0a21");
+		service->bind_subscription("Vehicle.TurboCharger.BoostLevel",
+					   "3e9a7d21-5c4b-4a8f-b6e2-0f1d2c3b4a59");
+	}
+
+	~Fixture()
+	{
+		fs::remove_all(dir);
+	}
+
+	// Runs whatever the last operation posted, e.g. encoding
+	void poll()
+	{
+		ioc.restart();
+		ioc.poll();
+	}
+};
+
+static Fixture &fixture()
+{
+	static Fixture fixture;
+	return fixture;
+}
+
+static void BM_Decode(benchmark::State &state)
+{
+	VisMessage message;
+	AllocationCounter allocations(state);
+	for (auto _ : state) {
+		bool ok = VisDecoder::decode(NOTIFICATION.data(), NOTIFICATION.size(), message);
+		benchmark::DoNotOptimize(ok);
+		benchmark::DoNotOptimize(message);
+	}
+}
+BENCHMARK(BM_Decode);
+
+static void BM_JsonParse(benchmark::State &state)
+{
+	AllocationCounter allocations(state);
+	for (auto _ : state) {
+		json message = json::parse(NOTIFICATION);
+		benchmark::DoNotOptimize(message);
+	}
+}
+BENCHMARK(BM_JsonParse);
+
+static void BM_ParseData(benchmark::State &state)
+{
+	BenchService &service = *fixture().service;
+	json message = json::parse(GET_RESPONSE);
+	VisSignalId signal;
+	VisValue value;
+	std::string_view timestamp;
+	AllocationCounter allocations(state);
+	for (auto _ : state) {
+		bool ok = service.parseData(message, signal, value, timestamp);
+		benchmark::DoNotOptimize(ok);
+	}
+}
+BENCHMARK(BM_ParseData);
+
+// The full-parse fallback path, from a parsed message to the mailbox
+static void BM_HandleMessage(benchmark::State &state)
+{
+	BenchService &service = *fixture().service;
+	json message = json::parse(NOTIFICATION);
+	AllocationCounter allocations(state);
+	for (auto _ : state)
+		service.handle_message(message);
+}
+BENCHMARK(BM_HandleMessage);
+
+// The usual path, from the raw message to the mailbox
+static void BM_HandleDecoded(benchmark::State &state)
+{
+	BenchService &service = *fixture().service;
+	const std::string &payload = state.range(0) ? NOTIFICATION_NUMBER : NOTIFICATION;
+	VisMessage message;
+	AllocationCounter allocations(state);
+	for (auto _ : state) {
+		VisDecoder::decode(payload.data(), payload.size(), message);
+		service.handle_decoded(message);
+	}
+}
+BENCHMARK(BM_HandleDecoded)->Arg(0)->Arg(1);
+
+static void BM_HandleNotification(benchmark::State &state)
+{
+	BenchService &service = *fixture().service;
+	VisSignalId signal = service.signal("Vehicle.Speed");
+	VisValue value(87.5);
+	AllocationCounter allocations(state);
+	for (auto _ : state)
+		service.handle_notification(signal, value, "2024-03-14T09:26:53.589653Z");
+}
+BENCHMARK(BM_HandleNotification);
+
+// Notification through encoding and frame assembly, every value differs
+// so every iteration yields a frame
+static void BM_NotificationToFrame(benchmark::State &state)
+{
+	Fixture &f = fixture();
+	VisSignalId signal = f.service->signal("Vehicle.Speed");
+	double speed = 0;
+	AllocationCounter allocations(state);
+	for (auto _ : state) {
+		speed = speed < 250 ? speed + 0.01 : 0;
+		f.service->handle_notification(signal, VisValue(speed), "2024-03-14T09:26:53.589653Z");
+		f.poll();
+	}
+}
+BENCHMARK(BM_NotificationToFrame);
+
+// Signal encoding alone, including a table lookup for the boost gauge
+static void BM_Encode(benchmark::State &state)
+{
+	Fixture &f = fixture();
+	CanSignalMap map;
+	boost::property_tree::ptree pt;
+	boost::property_tree::ini_parser::read_ini((f.dir / "AGL" / "agl-service-monitor.conf").string(), pt);
+	map.load(pt);
+	map.bind("Vehicle.Speed", 0);
+	map.bind("Vehicle.TurboCharger.BoostLevel", 1);
+	VisSignalId id = state.range(0);
+	double v = 0;
+	AllocationCounter allocations(state);
+	for (auto _ : state) {
+		v = v < 99 ? v + 1 : 0;
+		bool ok = map.encode(id, VisValue(v));
+		benchmark::DoNotOptimize(ok);
+		map.clear_dirty();
+	}
+}
+BENCHMARK(BM_Encode)->Arg(0)->Arg(1);
+
+// Encoding plus the scheduler collecting changed frames into a batch
+static void BM_EncodeAndSchedule(benchmark::State &state)
+{
+	Fixture &f = fixture();
+	CanSignalMap map;
+	boost::property_tree::ptree pt;
+	boost::property_tree::ini_parser::read_ini((f.dir / "AGL" / "agl-service-monitor.conf").string(), pt);
+	map.load(pt);
+	map.bind("Vehicle.Speed", 0);
+	std::size_t frames = 0;
+	CanTxScheduler scheduler(f.ioc, map, [&frames](const std::vector<struct can_frame> &batch) {
+		frames += batch.size();
+	});
+	double v = 0;
+	AllocationCounter allocations(state);
+	for (auto _ : state) {
+		v = v < 250 ? v + 0.01 : 0;
+		map.encode(0, VisValue(v));
+		scheduler.notify();
+		f.poll();
+	}
+	state.counters["frames"] = benchmark::Counter(static_cast<double>(frames), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_EncodeAndSchedule);
+
+// Notifications as read from the websocket, with changing values
+static std::vector<std::string> notification_stream()
+{
+	std::vector<std::string> messages;
+	for (int i = 0; i < 100; i++) {
+		messages.push_back(R"({"action":"subscription","subscriptionId":"7f1c5a0e-3b6d-4f8e-9a2c-1d4b6e8f0a21",)"
+				   R"("ts":"2024-03-14T09:26:53.589793Z","data":{"path":"Vehicle.Speed",)"
+				   R"("dp":{"value":")" + std::to_string(i * 2.5) + R"(","ts":"2024-03-14T09:26:53.589653Z"}}})");
+		messages.push_back(R"({"action":"subscription","subscriptionId":"3e9a7d21-5c4b-4a8f-b6e2-0f1d2c3b4a59",)"
+				   R"("ts":"2024-03-14T09:26:53.590012Z","data":{"path":"Vehicle.TurboCharger.BoostLevel",)"
+				   R"("dp":{"value":)" + std::to_string(i) + R"(,"ts":"2024-03-14T09:26:53.589981Z"}}})");
+		messages.push_back(R"({"action":"set","requestId":")" + std::to_string(i) +
+				   R"(","ts":"2024-03-14T09:26:53.590127Z"})");
+	}
+	return messages;
+}
+
+static bool g_steady_state_allocated = false;
+
+// The whole path from a websocket message to the frames handed to the
+// socket, driven from io_context handlers as in the service.  Once
+// warmed up it must not allocate, the run fails if it does.
+static void BM_SteadyState(benchmark::State &state)
+{
+	Fixture &f = fixture();
+	std::vector<std::string> messages = notification_stream();
+	std::size_t next = 0;
+	std::size_t warmup = 10 * messages.size();
+	uint64_t start = 0;
+
+	HandlerMemory &memory = net::use_service<HandlerMemory>(f.ioc);
+	bool fed = false;
+
+	// Every other run of the step only yields, so that what a message
+	// posted has run before the next one is fed, as when messages
+	// arrive at a realistic rate rather than back to back
+	std::function<void()> step = [&]() {
+		fed = !fed;
+		if (!fed) {
+			net::post(f.ioc, make_handler(memory, [&step]() { step(); }));
+			return;
+		}
+		if (warmup) {
+			if (--warmup == 0)
+				start = g_allocations.load(std::memory_order_relaxed);
+		} else if (!state.KeepRunning()) {
+			// The service keeps work outstanding, e.g. the netlink
+			// socket, so run() does not return by itself
+			f.ioc.stop();
+			return;
+		}
+		f.service->replay(messages[next], realtime_ns());
+		next = (next + 1) % messages.size();
+		net::post(f.ioc, make_handler(memory, [&step]() { step(); }));
+	};
+
+	f.ioc.restart();
+	net::post(f.ioc, make_handler(memory, [&step]() { step(); }));
+	f.ioc.run();
+
+	uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - start;
+	state.counters["allocs"] = benchmark::Counter(static_cast<double>(allocations),
+						      benchmark::Counter::kAvgIterations);
+	if (allocations) {
+		g_steady_state_allocated = true;
+		state.SkipWithError("steady state allocates");
+	}
+}
+BENCHMARK(BM_SteadyState);
+
+int main(int argc, char **argv)
+{
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return g_steady_state_allocated ? 1 : 0;
+}
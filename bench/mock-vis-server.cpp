@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "mock-vis-server.hpp"
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include "latency-histogram.hpp"
+
+// ISO 8601 wall clock time as KUKSA.val stamps datapoints
+static std::string timestamp()
+{
+	int64_t now = realtime_ns();
+	time_t seconds = now / 1000000000;
+	struct tm tm;
+	gmtime_r(&seconds, &tm);
+
+	char buffer[40];
+	std::size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buffer + length, sizeof(buffer) - length, ".%06dZ",
+		 static_cast<int>(now % 1000000000 / 1000));
+	return buffer;
+}
+
+class MockVisServer::Session : public std::enable_shared_from_this<Session>
+{
+	MockVisServer &m_server;
+	websocket::stream<beast::ssl_stream<beast::tcp_stream>> m_ws;
+	beast::flat_buffer m_buffer;
+	std::deque<std::string> m_write_queue;
+	bool m_open = false;
+
+public:
+	// path -> subscriptionId
+	std::unordered_map<std::string, std::string> subscriptions;
+
+	Session(MockVisServer &server, tcp::socket &&socket) :
+		m_server(server),
+		m_ws(std::move(socket), server.m_ctx)
+	{
+	}
+
+	void run()
+	{
+		m_ws.next_layer().async_handshake(ssl::stream_base::server,
+						  [self = shared_from_this()](beast::error_code error) {
+			if (error)
+				return;
+			self->m_ws.async_accept([self](beast::error_code error) {
+				if (error)
+					return;
+				self->m_open = true;
+				self->m_ws.text(true);
+				self->do_read();
+			});
+		});
+	}
+
+	void close()
+	{
+		m_open = false;
+		beast::error_code ec;
+		beast::get_lowest_layer(m_ws).socket().close(ec);
+	}
+
+	void send(std::string &&message)
+	{
+		if (!m_open)
+			return;
+		m_write_queue.push_back(std::move(message));
+		if (m_write_queue.size() == 1)
+			do_write();
+	}
+
+private:
+	void do_read()
+	{
+		m_ws.async_read(m_buffer, [self = shared_from_this()](beast::error_code error, std::size_t) {
+			if (error) {
+				self->m_open = false;
+				return;
+			}
+			auto data = self->m_buffer.data();
+			const char *begin = static_cast<const char*>(data.data());
+			json request = json::parse(begin, begin + data.size(), nullptr, false);
+			self->m_buffer.consume(self->m_buffer.size());
+			if (!request.is_discarded() && request.is_object())
+				self->m_server.handle_request(*self, request);
+			self->do_read();
+		});
+	}
+
+	void do_write()
+	{
+		m_ws.async_write(net::buffer(m_write_queue.front()),
+				 [self = shared_from_this()](beast::error_code error, std::size_t) {
+			if (error) {
+				self->m_open = false;
+				self->m_write_queue.clear();
+				return;
+			}
+			self->m_write_queue.pop_front();
+			if (!self->m_write_queue.empty())
+				self->do_write();
+		});
+	}
+};
+
+MockVisServer::MockVisServer(net::io_context &ioc, ssl::context &ctx) :
+	m_ctx(ctx),
+	m_acceptor(ioc, tcp::endpoint(net::ip::make_address("127.0.0.1"), 0))
+{
+	do_accept();
+}
+
+void MockVisServer::do_accept()
+{
+	m_acceptor.async_accept([this](beast::error_code error, tcp::socket socket) {
+		if (error)
+			return;
+		socket.set_option(tcp::no_delay(true));
+		if (m_session)
+			m_session->close();
+		m_session = std::make_shared<Session>(*this, std::move(socket));
+		m_subscription_count.store(0, std::memory_order_relaxed);
+		m_session->run();
+		do_accept();
+	});
+}
+
+bool MockVisServer::notify(const std::string &path, const std::string &value)
+{
+	if (!m_session)
+		return false;
+	auto &subscriptions = m_session->subscriptions;
+	auto it = subscriptions.find(path);
+	// Otherwise the subscription of a branch above it
+	for (std::size_t dot = path.rfind('.'); it == subscriptions.end() && dot != std::string::npos && dot > 0;
+	     dot = path.rfind('.', dot - 1))
+		it = subscriptions.find(path.substr(0, dot) + ".*");
+	if (it == subscriptions.end())
+		return false;
+
+	std::string ts = timestamp();
+	std::string message = "{\"action\":\"subscription\",\"subscriptionId\":\"";
+	message += it->second;
+	message += "\",\"data\":{\"path\":\"";
+	message += path;
+	message += "\",\"dp\":{\"value\":";
+	message += value;
+	message += ",\"ts\":\"";
+	message += ts;
+	message += "\"}},\"ts\":\"";
+	message += ts;
+	message += "\"}";
+	m_session->send(std::move(message));
+	return true;
+}
+
+void MockVisServer::handle_request(Session &session, const json &request)
+{
+	std::string action = request.value("action", "");
+	json response = {
+		{ "action", action },
+		{ "requestId", request.value("requestId", json()) },
+		{ "ts", timestamp() }
+	};
+
+	if (action == "authorize") {
+		response["TTL"] = 3600;
+	} else if (action == "subscribe" && request.contains("path") && request["path"].is_string()) {
+		std::string path = request["path"];
+		auto &id = session.subscriptions[path];
+		if (id.empty()) {
+			id = "bench-" + std::to_string(++m_next_subscription);
+			m_subscription_count.fetch_add(1, std::memory_order_relaxed);
+		}
+		response["subscriptionId"] = id;
+	} else if (action == "get" && request.contains("path") && request["path"].is_string()) {
+		std::string path = request["path"];
+		auto it = m_values.find(path);
+		json value = it != m_values.end() ? json::parse(it->second) : json(0);
+		response["data"] = { { "path", path }, { "dp", { { "value", value }, { "ts", response["ts"] } } } };
+	} else if (action == "set" && request.contains("path") && request["path"].is_string()) {
+		m_values[request["path"]] = request.value("value", json()).dump();
+		m_sets.fetch_add(1, std::memory_order_relaxed);
+	} else if (action == "unsubscribe") {
+		std::string id = request.value("subscriptionId", "");
+		auto &subscriptions = session.subscriptions;
+		auto it = std::find_if(subscriptions.begin(), subscriptions.end(),
+				       [&id](const auto &entry) { return entry.second == id; });
+		if (it != subscriptions.end()) {
+			subscriptions.erase(it);
+			m_subscription_count.fetch_sub(1, std::memory_order_relaxed);
+		}
+	} else {
+		response["error"] = { { "number", 400 }, { "reason", "Bad Request" },
+				      { "message", "Unsupported action" } };
+	}
+
+	session.send(response.dump());
+}
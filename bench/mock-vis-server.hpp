@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _MOCK_VIS_SERVER_HPP
+#define _MOCK_VIS_SERVER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <boost/beast/core.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+#include <nlohmann/json.hpp>
+
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+namespace net = boost::asio;
+namespace ssl = boost::asio::ssl;
+using tcp = boost::asio::ip::tcp;
+using json = nlohmann::json;
+
+// Minimal KUKSA.val stand-in speaking the VISS subset VisSession uses:
+// authorize, subscribe (including to branches, "Vehicle.Cabin.*"),
+// unsubscribe, get and set requests, and subscription notifications
+// pushed by notify().  Any token is accepted.  All
+// members other than the counters must be used on the io_context's
+// thread.
+class MockVisServer
+{
+public:
+	MockVisServer(net::io_context &ioc, ssl::context &ctx);
+
+	unsigned short port() const { return m_acceptor.local_endpoint().port(); };
+
+	// Sends a notification for path with value as its raw JSON
+	// token, false if nobody is subscribed to it
+	bool notify(const std::string &path, const std::string &value);
+
+	std::size_t subscriptions() const { return m_subscription_count.load(std::memory_order_relaxed); };
+	uint64_t sets() const { return m_sets.load(std::memory_order_relaxed); };
+
+private:
+	class Session;
+
+	ssl::context &m_ctx;
+	tcp::acceptor m_acceptor;
+	// The service keeps one connection, a new one replaces it
+	std::shared_ptr<Session> m_session;
+	std::unordered_map<std::string, std::string> m_values;
+	unsigned m_next_subscription = 0;
+
+	std::atomic<std::size_t> m_subscription_count{0};
+	std::atomic<uint64_t> m_sets{0};
+
+	void do_accept();
+	void handle_request(Session &session, const json &request);
+};
+
+#endif // _MOCK_VIS_SERVER_HPP
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "self-signed-cert.hpp"
+#include <cstdio>
+#include <memory>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+struct PkeyCtxDeleter { void operator()(EVP_PKEY_CTX *ctx) { EVP_PKEY_CTX_free(ctx); } };
+struct PkeyDeleter { void operator()(EVP_PKEY *pkey) { EVP_PKEY_free(pkey); } };
+struct X509Deleter { void operator()(X509 *x509) { X509_free(x509); } };
+struct FileDeleter { void operator()(FILE *file) { fclose(file); } };
+
+static std::unique_ptr<EVP_PKEY, PkeyDeleter> generate_key()
+{
+	std::unique_ptr<EVP_PKEY_CTX, PkeyCtxDeleter> ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr));
+	EVP_PKEY *pkey = nullptr;
+	if (!ctx ||
+	    EVP_PKEY_keygen_init(ctx.get()) <= 0 ||
+	    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), NID_X9_62_prime256v1) <= 0 ||
+	    EVP_PKEY_keygen(ctx.get(), &pkey) <= 0)
+		return nullptr;
+	return std::unique_ptr<EVP_PKEY, PkeyDeleter>(pkey);
+}
+
+bool write_self_signed_cert(const std::string &key_file, const std::string &cert_file)
+{
+	auto pkey = generate_key();
+	if (!pkey)
+		return false;
+
+	std::unique_ptr<X509, X509Deleter> x509(X509_new());
+	if (!x509)
+		return false;
+	X509_set_version(x509.get(), 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509.get()), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509.get()), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509.get()), 24 * 60 * 60);
+	X509_set_pubkey(x509.get(), pkey.get());
+
+	X509_NAME *name = X509_get_subject_name(x509.get());
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+				   reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(x509.get(), name);
+	if (!X509_sign(x509.get(), pkey.get(), EVP_sha256()))
+		return false;
+
+	std::unique_ptr<FILE, FileDeleter> key(fopen(key_file.c_str(), "w"));
+	if (!key || !PEM_write_PrivateKey(key.get(), pkey.get(), nullptr, nullptr, 0, nullptr, nullptr))
+		return false;
+	std::unique_ptr<FILE, FileDeleter> cert(fopen(cert_file.c_str(), "w"));
+	if (!cert || !PEM_write_X509(cert.get(), x509.get()))
+		return false;
+	return true;
+}
@@ -0,0 +1,12 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SELF_SIGNED_CERT_HPP
+#define _SELF_SIGNED_CERT_HPP
+
+#include <string>
+
+// Generates a P-256 key and a self-signed certificate for localhost,
+// written as PEM.  Good enough for both ends of a benchmark connection.
+bool write_self_signed_cert(const std::string &key_file, const std::string &cert_file);
+
+#endif // _SELF_SIGNED_CERT_HPP
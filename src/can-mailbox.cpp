@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "can-mailbox.hpp"
+
+bool CanMailbox::put(VisSignalId signal, double value, int64_t received)
+{
+	if (signal >= m_slots.size())
+		m_slots.resize(signal + 1, Slot{0.0, 0, false});
+
+	bool was_empty = m_full.empty();
+	Slot &slot = m_slots[signal];
+	if (slot.full) {
+		m_conflated++;
+	} else {
+		slot.full = true;
+		m_full.push_back(signal);
+	}
+	slot.value = value;
+	slot.received = received;
+	m_put++;
+	return was_empty;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _CAN_MAILBOX_HPP
+#define _CAN_MAILBOX_HPP
+
+#include <cstdint>
+#include <vector>
+#include "vis-signal-table.hpp"
+#include "metrics.hpp"
+
+// Latest value slot per signal between VSS notifications and CAN
+// encoding.  A value put while the previous one for the same signal is
+// still waiting replaces it, so however far the bus side falls behind,
+// memory is bounded by the number of signals and only the freshest
+// value of each is encoded.
+class CanMailbox
+{
+public:
+	// Stores value for signal along with when it was received,
+	// returns true if the mailbox was empty
+	bool put(VisSignalId signal, double value, int64_t received);
+
+	bool empty() const { return m_full.empty(); };
+
+	// Calls handler(signal, value, received) for every waiting value, in the
+	// order the signals were first put, and empties the mailbox
+	template<typename Handler>
+	void drain(Handler handler)
+	{
+		for (VisSignalId signal : m_full) {
+			Slot &slot = m_slots[signal];
+			slot.full = false;
+			handler(signal, slot.value, slot.received);
+		}
+		m_full.clear();
+	}
+
+	uint64_t put_count() const { return m_put; };
+	uint64_t conflated() const { return m_conflated; };
+
+private:
+	struct Slot
+	{
+		double value;
+		int64_t received;
+		bool full;
+	};
+
+	std::vector<Slot> m_slots;		// indexed by signal ID
+	std::vector<VisSignalId> m_full;
+
+	Counter m_put;
+	Counter m_conflated;
+};
+
+#endif // _CAN_MAILBOX_HPP
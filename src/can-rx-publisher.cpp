@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "can-rx-publisher.hpp"
+#include <algorithm>
+
+CanRxPublisher::CanRxPublisher(net::io_context &ioc, PublishHandler publish) :
+	m_publish(publish),
+	m_timer(ioc),
+	m_timer_armed(false),
+	m_handler_memory(net::use_service<HandlerMemory>(ioc))
+{
+}
+
+void CanRxPublisher::offer(VisSignalId signal, const VisValue &value, unsigned min_interval)
+{
+	if (signal >= m_state.size())
+		m_state.resize(signal + 1, SignalState{});
+	SignalState &state = m_state[signal];
+	state.min_interval = min_interval;
+
+	// Frames are typically repeated cyclically with the same content
+	if (state.last.valid() && value == state.last) {
+		state.has_held = false;
+		m_duplicates++;
+		return;
+	}
+
+	auto now = clock::now();
+	if (state.last.valid() &&
+	    now < state.last_tx + std::chrono::milliseconds(min_interval)) {
+		if (!state.listed) {
+			state.listed = true;
+			m_held.push_back(signal);
+		}
+		state.has_held = true;
+		state.held = value;
+		m_rate_limited++;
+		return;
+	}
+
+	// A signal is published once per batch with its latest value
+	if (!state.queued) {
+		state.queued = true;
+		m_batch.push_back(signal);
+	}
+	state.last = value;
+	state.last_tx = now;
+	state.has_held = false;
+}
+
+void CanRxPublisher::flush()
+{
+	for (VisSignalId signal : m_batch) {
+		m_state[signal].queued = false;
+		m_publish(signal, m_state[signal].last);
+		m_published++;
+	}
+	m_batch.clear();
+
+	arm_timer();
+}
+
+void CanRxPublisher::on_timer(const boost::system::error_code &error)
+{
+	if (error)
+		return;
+
+	m_timer_armed = false;
+
+	// Publish held values whose interval has passed
+	auto now = clock::now();
+	auto it = m_held.begin();
+	while (it != m_held.end()) {
+		SignalState &state = m_state[*it];
+		if (!state.has_held) {
+			state.listed = false;
+			it = m_held.erase(it);
+		} else if (now >= state.last_tx + std::chrono::milliseconds(state.min_interval)) {
+			state.has_held = false;
+			state.listed = false;
+			state.last = state.held;
+			state.last_tx = now;
+			if (!state.queued) {
+				state.queued = true;
+				m_batch.push_back(*it);
+			}
+			it = m_held.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	flush();
+}
+
+void CanRxPublisher::arm_timer()
+{
+	clock::time_point deadline = clock::time_point::max();
+	for (VisSignalId signal : m_held) {
+		const SignalState &state = m_state[signal];
+		if (state.has_held)
+			deadline = std::min(deadline, state.last_tx + std::chrono::milliseconds(state.min_interval));
+	}
+
+	// Cancelling leaves the expiry set, so it is only compared while
+	// a wait is outstanding
+	if (deadline == clock::time_point::max()) {
+		if (m_timer_armed)
+			m_timer.cancel();
+		m_timer_armed = false;
+		return;
+	}
+	if (m_timer_armed && m_timer.expiry() == deadline)
+		return;
+
+	m_timer_armed = true;
+	m_timer.expires_at(deadline);
+	m_timer.async_wait(make_handler(m_handler_memory, [this](const boost::system::error_code &error) {
+		on_timer(error);
+	}));
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _CAN_RX_PUBLISHER_HPP
+#define _CAN_RX_PUBLISHER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "vis-signal-table.hpp"
+#include "metrics.hpp"
+#include "vis-value.hpp"
+#include "handler-allocator.hpp"
+
+namespace net = boost::asio;
+
+// Decides which values decoded from received CAN frames are published
+// to VSS.  A value equal to the last one published for its signal is
+// dropped, and a signal is published at most once per its min-interval;
+// the latest value held back that way goes out when the interval ends.
+//
+// Values offered while draining the socket are collected and handed
+// to the publish handler together on flush().
+class CanRxPublisher
+{
+public:
+	typedef std::function<void(VisSignalId signal, const VisValue &value)> PublishHandler;
+
+	CanRxPublisher(net::io_context &ioc, PublishHandler publish);
+
+	void offer(VisSignalId signal, const VisValue &value, unsigned min_interval);
+
+	void flush();
+
+	uint64_t published() const { return m_published; };
+	uint64_t duplicates() const { return m_duplicates; };
+	uint64_t rate_limited() const { return m_rate_limited; };
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct SignalState
+	{
+		VisValue last;		// last published
+		VisValue held;		// newer value held back by min-interval
+		bool has_held;
+		bool queued;		// in m_batch
+		bool listed;		// in m_held
+		unsigned min_interval;
+		clock::time_point last_tx;
+	};
+
+	PublishHandler m_publish;
+	net::steady_timer m_timer;
+	bool m_timer_armed;	// a wait is outstanding on m_timer
+	HandlerMemory &m_handler_memory;
+	std::vector<SignalState> m_state;	// indexed by signal ID
+	std::vector<VisSignalId> m_batch;
+	std::vector<VisSignalId> m_held;
+
+	Counter m_published;
+	Counter m_duplicates;
+	Counter m_rate_limited;
+
+	void on_timer(const boost::system::error_code &error);
+
+	void arm_timer();
+};
+
+#endif // _CAN_RX_PUBLISHER_HPP
@@ -0,0 +1,605 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "can-signal-map.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace property_tree = boost::property_tree;
+
+// Largest integer input range expanded into a dense lookup table
+#define MAX_DENSE_TABLE 4096
+
+// Strips optional quotes, unlike reading with std::quoted unquoted
+// values may contain spaces
+static std::string unquote(const std::string &value)
+{
+	if (value.empty() || value[0] != '"')
+		return value;
+
+	std::string result;
+	std::stringstream ss;
+	ss << value;
+	ss >> std::quoted(result);
+	return result;
+}
+
+static bool parse_uint(const std::string &value, unsigned long &out)
+{
+	std::string s = unquote(value);
+	if (s.empty())
+		return false;
+	char *end;
+	out = strtoul(s.c_str(), &end, 0);
+	return *end == '\0';
+}
+
+static bool parse_double(const std::string &value, double &out)
+{
+	std::string s = unquote(value);
+	if (s.empty())
+		return false;
+	char *end;
+	out = strtod(s.c_str(), &end);
+	return *end == '\0' && std::isfinite(out);
+}
+
+static inline uint64_t load_word(const uint8_t *data, bool big_endian)
+{
+	uint64_t word = 0;
+	for (unsigned i = 0; i < CAN_MAX_DLEN; i++) {
+		unsigned byte = big_endian ? i : CAN_MAX_DLEN - 1 - i;
+		word = (word << 8) | data[byte];
+	}
+	return word;
+}
+
+static inline void store_word(uint8_t *data, bool big_endian, uint64_t word)
+{
+	for (unsigned i = 0; i < CAN_MAX_DLEN; i++) {
+		unsigned byte = big_endian ? CAN_MAX_DLEN - 1 - i : i;
+		data[byte] = word & 0xff;
+		word >>= 8;
+	}
+}
+
+bool CanSignalMap::load(const property_tree::ptree &pt)
+{
+	m_frames.clear();
+	m_signals.clear();
+	m_tables.clear();
+	m_ops.clear();
+	m_plan.clear();
+	m_frame_signals.clear();
+	m_dirty.clear();
+	m_decode.clear();
+	m_rx_plan.clear();
+	m_rx_frames.clear();
+
+	// Frames first, so signals can refer to them in any order
+	for (auto &section : pt) {
+		if (section.first.rfind("frame:", 0) != 0)
+			continue;
+
+		const property_tree::ptree &settings = section.second;
+		Frame frame = {};
+		unsigned long value;
+		if (!parse_uint(settings.get("id", ""), value) || value > CAN_EFF_MASK) {
+			std::cerr << "Invalid CAN id for " << section.first << std::endl;
+			return false;
+		}
+		frame.id = value;
+		if (value > CAN_SFF_MASK)
+			frame.id |= CAN_EFF_FLAG;
+		if (find_frame(frame.id) >= 0) {
+			std::cerr << "Duplicate CAN id for " << section.first << std::endl;
+			return false;
+		}
+
+		if (!parse_uint(settings.get("dlc", "8"), value) || value > CAN_MAX_DLEN) {
+			std::cerr << "Invalid dlc for " << section.first << std::endl;
+			return false;
+		}
+		frame.dlc = value;
+
+		// Default payload as hex bytes, used for any bits not
+		// covered by a signal
+		std::stringstream ss(unquote(settings.get("data", "")));
+		std::string byte;
+		unsigned i = 0;
+		while (ss >> byte) {
+			char *end;
+			unsigned long b = strtoul(byte.c_str(), &end, 16);
+			if (*end != '\0' || b > 0xff || i >= CAN_MAX_DLEN) {
+				std::cerr << "Invalid data for " << section.first << std::endl;
+				return false;
+			}
+			frame.data[i++] = b;
+		}
+
+		std::string direction = unquote(settings.get("direction", "tx"));
+		if (direction == "rx") {
+			frame.rx = true;
+		} else if (direction != "tx") {
+			std::cerr << "Invalid direction for " << section.first << std::endl;
+			return false;
+		}
+
+		std::string mode = unquote(settings.get("mode", "on-change"));
+		if (mode == "on-change") {
+			frame.mode = Mode::OnChange;
+		} else if (mode == "cyclic") {
+			frame.mode = Mode::Cyclic;
+		} else if (mode == "cyclic-on-change") {
+			frame.mode = Mode::CyclicOnChange;
+		} else {
+			std::cerr << "Invalid mode for " << section.first << std::endl;
+			return false;
+		}
+
+		if (!parse_uint(settings.get("cycle-time", "0"), value) ||
+		    (frame.mode != Mode::OnChange && value == 0)) {
+			std::cerr << "Invalid cycle-time for " << section.first << std::endl;
+			return false;
+		}
+		frame.cycle_time = value;
+
+		if (!parse_uint(settings.get("min-interval", "0"), value)) {
+			std::cerr << "Invalid min-interval for " << section.first << std::endl;
+			return false;
+		}
+		frame.min_interval = value;
+
+		m_frames.push_back(frame);
+	}
+
+	for (auto &section : pt) {
+		if (section.first.rfind("signal:", 0) != 0)
+			continue;
+
+		const property_tree::ptree &settings = section.second;
+		Signal signal = {};
+		signal.name = section.first.substr(7);
+		signal.path = unquote(settings.get("path", ""));
+		if (signal.path.empty()) {
+			std::cerr << "Missing path for " << section.first << std::endl;
+			return false;
+		}
+
+		unsigned long value;
+		int frame = -1;
+		if (parse_uint(settings.get("frame", ""), value)) {
+			canid_t id = value;
+			if (value > CAN_SFF_MASK)
+				id |= CAN_EFF_FLAG;
+			frame = find_frame(id);
+		}
+		if (frame < 0) {
+			std::cerr << "Invalid frame for " << section.first << std::endl;
+			return false;
+		}
+		signal.frame = frame;
+
+		std::string order = unquote(settings.get("byte-order", "little-endian"));
+		if (order == "little-endian" || order == "intel") {
+			signal.big_endian = false;
+		} else if (order == "big-endian" || order == "motorola") {
+			signal.big_endian = true;
+		} else {
+			std::cerr << "Invalid byte-order for " << section.first << std::endl;
+			return false;
+		}
+
+		unsigned long start, length;
+		if (!parse_uint(settings.get("start-bit", ""), start) ||
+		    !parse_uint(settings.get("length", ""), length) ||
+		    start >= 64 || length == 0 || length > 64) {
+			std::cerr << "Invalid bit position for " << section.first << std::endl;
+			return false;
+		}
+		signal.start_bit = start;
+		signal.length = length;
+
+		// The field must lie within the frame's payload
+		const Frame &f = m_frames[signal.frame];
+		bool fits;
+		if (signal.big_endian) {
+			// Start bit is the MSB, in DBC sawtooth numbering
+			int msb = (7 - start / 8) * 8 + start % 8;
+			int lsb = msb - static_cast<int>(length) + 1;
+			fits = lsb >= 0 && static_cast<unsigned>(7 - lsb / 8) < f.dlc;
+		} else {
+			fits = start + length <= 64 && (start + length - 1) / 8 < f.dlc;
+		}
+		if (!fits) {
+			std::cerr << "Signal " << section.first << " does not fit its frame" << std::endl;
+			return false;
+		}
+
+		std::string s = unquote(settings.get("signed", "false"));
+		signal.is_signed = (s == "true" || s == "1");
+		s = unquote(settings.get("truncate", "false"));
+		signal.truncate = (s == "true" || s == "1");
+
+		signal.factor = 1.0;
+		signal.offset = 0.0;
+		signal.min = -std::numeric_limits<double>::infinity();
+		signal.max = std::numeric_limits<double>::infinity();
+		if ((settings.count("factor") && !parse_double(settings.get("factor", ""), signal.factor)) ||
+		    signal.factor == 0.0 ||
+		    (settings.count("offset") && !parse_double(settings.get("offset", ""), signal.offset)) ||
+		    (settings.count("min") && !parse_double(settings.get("min", ""), signal.min)) ||
+		    (settings.count("max") && !parse_double(settings.get("max", ""), signal.max))) {
+			std::cerr << "Invalid scaling for " << section.first << std::endl;
+			return false;
+		}
+
+		unsigned long interval = 0;
+		if (!parse_uint(settings.get("min-interval", "0"), interval)) {
+			std::cerr << "Invalid min-interval for " << section.first << std::endl;
+			return false;
+		}
+		signal.min_interval = interval;
+
+		signal.table = -1;
+		std::string spec = unquote(settings.get("table", ""));
+		if (!spec.empty() && f.rx) {
+			std::cerr << "Tables are not supported for received " << section.first << std::endl;
+			return false;
+		}
+		if (!spec.empty()) {
+			Table table;
+			if (!parse_table(spec, signal.min, signal.max, table)) {
+				std::cerr << "Invalid table for " << section.first << std::endl;
+				return false;
+			}
+			signal.table = m_tables.size();
+			m_tables.push_back(std::move(table));
+		}
+
+		m_signals.push_back(signal);
+	}
+
+	if (m_signals.empty())
+		load_defaults();
+
+	compile_rx();
+	return true;
+}
+
+void CanSignalMap::load_defaults()
+{
+	// Turbo boost gauge, byte 1 drives the needle and byte 3
+	// carries the raw level.
+	Frame frame = { 0x201, 8, { 0x00, 0x00, 0x00, 0x00, 0x0B, 0xAD, 0xCA, 0x78 }, false,
+			Mode::OnChange, 0, 0, false };
+	m_frames.push_back(frame);
+
+	Signal gauge = {};
+	gauge.name = "boost-gauge";
+	gauge.path = "Vehicle.TurboCharger.BoostLevel";
+	gauge.frame = m_frames.size() - 1;
+	gauge.start_bit = 8;
+	gauge.length = 8;
+	gauge.factor = 1.0;
+	gauge.min = 0;
+	gauge.max = 99;
+	// The level used to be parsed with std::stoi
+	gauge.truncate = true;
+
+	Table table;
+	parse_table("0:50,79:129,80:170,100:210", gauge.min, gauge.max, table);
+	gauge.table = m_tables.size();
+	m_tables.push_back(std::move(table));
+	m_signals.push_back(gauge);
+
+	Signal level = gauge;
+	level.name = "boost-level";
+	level.start_bit = 24;
+	level.table = -1;
+	m_signals.push_back(level);
+}
+
+// Bit position of the field's LSB within the frame word
+static unsigned field_shift(unsigned start_bit, unsigned length, bool big_endian)
+{
+	if (!big_endian)
+		return start_bit;
+	unsigned msb = (7 - start_bit / 8) * 8 + start_bit % 8;
+	return msb - length + 1;
+}
+
+void CanSignalMap::compile_rx()
+{
+	// Decode operations grouped by frame, bound to signal IDs later
+	m_rx_plan.assign(m_frames.size(), PlanEntry{0, 0});
+	for (std::size_t index = 0; index < m_frames.size(); index++) {
+		if (!m_frames[index].rx)
+			continue;
+
+		PlanEntry entry = { static_cast<uint32_t>(m_decode.size()), 0 };
+		for (std::size_t i = 0; i < m_signals.size(); i++) {
+			const Signal &signal = m_signals[i];
+			if (signal.frame != index)
+				continue;
+
+			DecodeOp op;
+			op.shift = field_shift(signal.start_bit, signal.length, signal.big_endian);
+			op.big_endian = signal.big_endian;
+			op.is_signed = signal.is_signed;
+			op.mask = signal.length == 64 ? ~0ULL : (1ULL << signal.length) - 1;
+			op.factor = signal.factor;
+			op.offset = signal.offset;
+			op.integral = signal.factor == std::trunc(signal.factor) &&
+				signal.offset == std::trunc(signal.offset) && signal.length < 53;
+			op.min = signal.min;
+			op.max = signal.max;
+			op.min_interval = signal.min_interval;
+			op.source = i;
+			op.signal = INVALID_SIGNAL_ID;
+			m_decode.push_back(op);
+			entry.count++;
+		}
+		m_rx_plan[index] = entry;
+		m_rx_frames[m_frames[index].id] = index;
+	}
+}
+
+int CanSignalMap::find_frame(canid_t id) const
+{
+	for (std::size_t i = 0; i < m_frames.size(); i++) {
+		if (m_frames[i].id == id)
+			return i;
+	}
+	return -1;
+}
+
+bool CanSignalMap::parse_table(const std::string &spec, double min, double max, Table &table)
+{
+	// Comma separated input:output pairs
+	std::stringstream ss(spec);
+	std::string point;
+	while (std::getline(ss, point, ',')) {
+		auto colon = point.find(':');
+		double in, out;
+		if (colon == std::string::npos ||
+		    !parse_double(point.substr(0, colon), in) ||
+		    !parse_double(point.substr(colon + 1), out) ||
+		    out < 0)
+			return false;
+		table.points.emplace_back(in, out);
+	}
+	if (table.points.empty())
+		return false;
+	std::sort(table.points.begin(), table.points.end());
+
+	// Precompute integer inputs over a small bounded range
+	table.dense_min = 0;
+	if (std::isfinite(min) && std::isfinite(max) && max >= min &&
+	    max - min < MAX_DENSE_TABLE) {
+		table.dense_min = std::ceil(min);
+		for (int64_t x = table.dense_min; x <= max; x++) {
+			double y;
+			auto &p = table.points;
+			if (x <= p.front().first) {
+				y = p.front().second;
+			} else if (x >= p.back().first) {
+				y = p.back().second;
+			} else {
+				auto hi = std::upper_bound(p.begin(), p.end(), std::make_pair(double(x), -1.0),
+							   [](auto &a, auto &b) { return a.first < b.first; });
+				auto lo = hi - 1;
+				y = lo->second + (x - lo->first) * (hi->second - lo->second) / (hi->first - lo->first);
+			}
+			table.dense.push_back(std::llround(y));
+		}
+	}
+	return true;
+}
+
+std::vector<std::string> CanSignalMap::paths() const
+{
+	std::vector<std::string> paths;
+	for (auto &signal : m_signals) {
+		if (m_frames[signal.frame].rx)
+			continue;
+		if (std::find(paths.begin(), paths.end(), signal.path) == paths.end())
+			paths.push_back(signal.path);
+	}
+	return paths;
+}
+
+std::vector<std::string> CanSignalMap::rx_paths() const
+{
+	std::vector<std::string> paths;
+	for (auto &signal : m_signals) {
+		if (!m_frames[signal.frame].rx)
+			continue;
+		if (std::find(paths.begin(), paths.end(), signal.path) == paths.end())
+			paths.push_back(signal.path);
+	}
+	return paths;
+}
+
+std::vector<canid_t> CanSignalMap::rx_ids() const
+{
+	std::vector<canid_t> ids;
+	for (auto &frame : m_frames) {
+		if (frame.rx)
+			ids.push_back(frame.id);
+	}
+	return ids;
+}
+
+const std::vector<VisSignalId> *CanSignalMap::signals_of(canid_t id) const
+{
+	int index = find_frame(id);
+	if (index < 0 || static_cast<std::size_t>(index) >= m_frame_signals.size())
+		return nullptr;
+	return &m_frame_signals[index];
+}
+
+void CanSignalMap::bind_rx(const std::string &path, VisSignalId id)
+{
+	for (auto &op : m_decode) {
+		if (m_signals[op.source].path == path)
+			op.signal = id;
+	}
+}
+
+bool CanSignalMap::decode(const struct can_frame &frame, std::vector<RxValue> &out) const
+{
+	auto it = m_rx_frames.find(frame.can_id & (CAN_EFF_FLAG | CAN_EFF_MASK));
+	if (it == m_rx_frames.end())
+		return false;
+	if (frame.can_dlc < m_frames[it->second].dlc)
+		return false;
+
+	uint8_t data[CAN_MAX_DLEN] = {};
+	memcpy(data, frame.data, std::min<unsigned>(frame.can_dlc, CAN_MAX_DLEN));
+
+	const PlanEntry &entry = m_rx_plan[it->second];
+	for (uint32_t i = entry.begin; i < entry.begin + entry.count; i++) {
+		const DecodeOp &op = m_decode[i];
+		if (op.signal == INVALID_SIGNAL_ID)
+			continue;
+
+		uint64_t raw = (load_word(data, op.big_endian) >> op.shift) & op.mask;
+		int64_t sraw = raw;
+		if (op.is_signed && op.mask != ~0ULL && (raw & ~(op.mask >> 1)))
+			sraw = static_cast<int64_t>(raw | ~op.mask);
+
+		// Out of range raw values are taken as invalid data
+		double phys = (op.is_signed ? static_cast<double>(sraw) : static_cast<double>(raw)) *
+			op.factor + op.offset;
+		if (phys < op.min || phys > op.max)
+			continue;
+
+		RxValue rx = { op.signal, op.min_interval, VisValue() };
+		if (op.integral && phys >= 0 && !op.is_signed)
+			rx.value = VisValue(static_cast<uint64_t>(phys));
+		else if (op.integral)
+			rx.value = VisValue(static_cast<int64_t>(phys));
+		else
+			rx.value = VisValue(phys);
+		out.push_back(rx);
+	}
+	return true;
+}
+
+void CanSignalMap::bind(const std::string &path, VisSignalId id)
+{
+	if (id >= m_plan.size())
+		m_plan.resize(id + 1, PlanEntry{0, 0});
+	if (m_plan[id].count)
+		return;
+
+	// Operations of a signal are kept contiguous
+	PlanEntry entry = { static_cast<uint32_t>(m_ops.size()), 0 };
+	for (auto &signal : m_signals) {
+		if (signal.path != path || m_frames[signal.frame].rx)
+			continue;
+
+		EncodeOp op;
+		op.frame = signal.frame;
+		op.big_endian = signal.big_endian;
+		op.shift = field_shift(signal.start_bit, signal.length, signal.big_endian);
+		op.mask = signal.length == 64 ? ~0ULL : (1ULL << signal.length) - 1;
+		op.is_signed = signal.is_signed;
+		op.truncate = signal.truncate;
+		op.factor = signal.factor;
+		op.offset = signal.offset;
+		op.min = signal.min;
+		op.max = signal.max;
+		op.table = signal.table;
+		m_ops.push_back(op);
+		entry.count++;
+
+		if (m_frame_signals.size() < m_frames.size())
+			m_frame_signals.resize(m_frames.size());
+		auto &signals = m_frame_signals[op.frame];
+		if (std::find(signals.begin(), signals.end(), id) == signals.end())
+			signals.push_back(id);
+	}
+	m_plan[id] = entry;
+}
+
+uint64_t CanSignalMap::to_raw(const EncodeOp &op, double value) const
+{
+	double raw;
+	if (op.table >= 0) {
+		const Table &table = m_tables[op.table];
+		double index = value - table.dense_min;
+		if (!table.dense.empty() && index >= 0 && index < table.dense.size() &&
+		    index == std::floor(index))
+			return std::min(table.dense[static_cast<std::size_t>(index)], op.mask);
+
+		auto &p = table.points;
+		if (value <= p.front().first) {
+			raw = p.front().second;
+		} else if (value >= p.back().first) {
+			raw = p.back().second;
+		} else {
+			auto hi = std::upper_bound(p.begin(), p.end(), std::make_pair(value, -1.0),
+						   [](auto &a, auto &b) { return a.first < b.first; });
+			auto lo = hi - 1;
+			raw = lo->second + (value - lo->first) * (hi->second - lo->second) / (hi->first - lo->first);
+		}
+	} else {
+		raw = (value - op.offset) / op.factor;
+	}
+
+	// Saturate to what the field can hold
+	raw = std::round(raw);
+	if (op.is_signed) {
+		double limit = static_cast<double>(op.mask >> 1);
+		raw = std::max(-limit - 1, std::min(limit, raw));
+		return static_cast<uint64_t>(static_cast<int64_t>(raw)) & op.mask;
+	}
+	raw = std::max(0.0, std::min(static_cast<double>(op.mask), raw));
+	return static_cast<uint64_t>(raw);
+}
+
+bool CanSignalMap::encode(VisSignalId id, const VisValue &value)
+{
+	if (id >= m_plan.size() || m_plan[id].count == 0)
+		return false;
+
+	double phys;
+	if (!value.to_double(phys))
+		return false;
+
+	bool encoded = false;
+	const PlanEntry &entry = m_plan[id];
+	for (uint32_t i = entry.begin; i < entry.begin + entry.count; i++) {
+		const EncodeOp &op = m_ops[i];
+		double value = op.truncate ? std::trunc(phys) : phys;
+		if (value < op.min || value > op.max)
+			continue;
+
+		Frame &frame = m_frames[op.frame];
+		uint64_t word = load_word(frame.data, op.big_endian);
+		word &= ~(op.mask << op.shift);
+		word |= (to_raw(op, value) & op.mask) << op.shift;
+		store_word(frame.data, op.big_endian, word);
+
+		if (!frame.dirty) {
+			frame.dirty = true;
+			m_dirty.push_back(op.frame);
+		}
+		encoded = true;
+	}
+	return encoded;
+}
+
+void CanSignalMap::clear_dirty()
+{
+	for (uint16_t index : m_dirty)
+		m_frames[index].dirty = false;
+	m_dirty.clear();
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _CAN_SIGNAL_MAP_HPP
+#define _CAN_SIGNAL_MAP_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <linux/can.h>
+#include <boost/property_tree/ptree.hpp>
+#include "vis-signal-table.hpp"
+#include "vis-value.hpp"
+
+// Maps VSS signals onto fields of CAN frames.  The mapping is read from
+// [frame:*] and [signal:*] configuration sections, e.g.:
+//
+//   [frame:boost]
+//   id=0x201
+//   dlc=8
+//   data=00 00 00 00 0B AD CA 78
+//   mode=on-change
+//
+//   [signal:boost-gauge]
+//   path=Vehicle.TurboCharger.BoostLevel
+//   frame=0x201
+//   start-bit=8
+//   length=8
+//   byte-order=little-endian
+//   min=0
+//   max=99
+//   table=0:50,79:129,80:170,100:210
+//
+// Once the VSS paths are bound to signal IDs, the mapping is compiled
+// into a flat list of encode operations indexed by signal ID, so that
+// encoding a value is a lookup plus a few bit operations.
+//
+// Frames with direction=rx are received rather than sent, their signals
+// are decoded and published to VSS.  Such signals may set min-interval
+// to limit how often they are published.
+class CanSignalMap
+{
+public:
+	// How a frame is scheduled for transmission
+	enum class Mode { OnChange, Cyclic, CyclicOnChange };
+
+	struct Frame
+	{
+		canid_t id;
+		uint8_t dlc;
+		uint8_t data[CAN_MAX_DLEN];
+		bool dirty;
+		Mode mode;
+		unsigned cycle_time;	// ms, for cyclic modes
+		unsigned min_interval;	// ms between on-change transmissions
+		bool rx;		// received from the bus
+	};
+
+	// Signal value decoded from a received frame
+	struct RxValue
+	{
+		VisSignalId signal;
+		unsigned min_interval;	// ms between publications
+		VisValue value;
+	};
+
+	// Loads the mapping from configuration, returns false if it is
+	// invalid.  Without any [signal:*] sections the built-in default
+	// mapping is used.
+	bool load(const boost::property_tree::ptree &pt);
+
+	// VSS paths that have at least one mapped field in a sent frame
+	std::vector<std::string> paths() const;
+
+	// VSS paths decoded from received frames
+	std::vector<std::string> rx_paths() const;
+
+	// CAN IDs of received frames
+	std::vector<canid_t> rx_ids() const;
+
+	// Compiles the encode operations for path under signal ID id
+	void bind(const std::string &path, VisSignalId id);
+
+	// Signal IDs encoded into the frame with CAN id id, nullptr if
+	// the frame is not mapped
+	const std::vector<VisSignalId> *signals_of(canid_t id) const;
+
+	// Publishes fields decoded for path under signal ID id
+	void bind_rx(const std::string &path, VisSignalId id);
+
+	// Decodes the bound signals of a received frame into out, returns
+	// false if the frame is not mapped or too short
+	bool decode(const struct can_frame &frame, std::vector<RxValue> &out) const;
+
+	// Encodes value into the shadow payloads of the frames mapped
+	// from signal id, marking them dirty.  Returns false if the
+	// signal is not mapped or the value is unusable.
+	bool encode(VisSignalId id, const VisValue &value);
+
+	std::vector<Frame> &frames() { return m_frames; };
+
+	// Indices of frames that were modified since the last call to
+	// clear_dirty()
+	const std::vector<uint16_t> &dirty() const { return m_dirty; };
+
+	void clear_dirty();
+
+private:
+	// Piecewise linear lookup table, points sorted by input value
+	struct Table
+	{
+		std::vector<std::pair<double, double>> points;
+		// Dense table for integer inputs from min, if small enough
+		int64_t dense_min;
+		std::vector<uint64_t> dense;
+	};
+
+	// Signal as configured
+	struct Signal
+	{
+		std::string name;
+		std::string path;
+		uint16_t frame;
+		unsigned start_bit;
+		unsigned length;
+		bool big_endian;
+		bool is_signed;
+		bool truncate;		// values truncated toward zero first
+		double factor;
+		double offset;
+		double min;
+		double max;
+		int table;
+		unsigned min_interval;
+	};
+
+	// Compiled encode operation
+	struct EncodeOp
+	{
+		uint16_t frame;
+		uint8_t shift;
+		bool big_endian;
+		bool is_signed;
+		uint64_t mask;
+		bool truncate;
+		double factor;
+		double offset;
+		double min;
+		double max;
+		int table;
+	};
+
+	// Compiled decode operation
+	struct DecodeOp
+	{
+		uint8_t shift;
+		bool big_endian;
+		bool is_signed;
+		bool integral;		// integer scaling, published as integer
+		uint64_t mask;
+		double factor;
+		double offset;
+		double min;
+		double max;
+		unsigned min_interval;
+		uint32_t source;	// index into m_signals
+		VisSignalId signal;
+	};
+
+	struct PlanEntry
+	{
+		uint32_t begin;
+		uint32_t count;
+	};
+
+	std::vector<Frame> m_frames;
+	std::vector<Signal> m_signals;
+	std::vector<Table> m_tables;
+	std::vector<EncodeOp> m_ops;
+	std::vector<PlanEntry> m_plan;	// indexed by signal ID
+	std::vector<std::vector<VisSignalId>> m_frame_signals;	// indexed by frame
+	std::vector<uint16_t> m_dirty;
+	std::vector<DecodeOp> m_decode;
+	std::vector<PlanEntry> m_rx_plan;	// indexed by frame
+	std::unordered_map<canid_t, uint16_t> m_rx_frames;
+
+	void load_defaults();
+
+	void compile_rx();
+
+	int find_frame(canid_t id) const;
+
+	bool parse_table(const std::string &spec, double min, double max, Table &table);
+
+	uint64_t to_raw(const EncodeOp &op, double value) const;
+};
+
+#endif // _CAN_SIGNAL_MAP_HPP
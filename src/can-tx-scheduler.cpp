@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "can-tx-scheduler.hpp"
+#include <cstring>
+#include <boost/asio/post.hpp>
+
+CanTxScheduler::CanTxScheduler(net::io_context &ioc, CanSignalMap &map, TransmitHandler transmit) :
+	m_ioc(ioc),
+	m_map(map),
+	m_transmit(transmit),
+	m_timer(ioc),
+	m_timer_armed(false),
+	m_handler_memory(net::use_service<HandlerMemory>(ioc)),
+	m_flush_posted(false)
+{
+}
+
+void CanTxScheduler::notify()
+{
+	// Defer to after the current batch of handlers, so several
+	// notifications touching the same frame result in one frame.
+	if (m_flush_posted) {
+		m_coalesced++;
+		return;
+	}
+	m_flush_posted = true;
+	net::post(m_ioc, make_handler(m_handler_memory, [this]() {
+		m_flush_posted = false;
+		flush();
+	}));
+}
+
+void CanTxScheduler::flush()
+{
+	auto &frames = m_map.frames();
+	if (m_state.size() < frames.size())
+		m_state.resize(frames.size(), FrameState{});
+
+	auto now = clock::now();
+	for (uint16_t index : m_map.dirty()) {
+		const CanSignalMap::Frame &frame = frames[index];
+		FrameState &state = m_state[index];
+
+		// Cyclic transmission starts once the frame has content
+		if (!state.has_data) {
+			state.has_data = true;
+			state.next_cycle = now;
+		}
+
+		if (offloaded(frame)) {
+			// Only changes need to be passed on, announced if the
+			// mode asks for it and min-interval allows.
+			if (changed(index)) {
+				bool announce = frame.mode == CanSignalMap::Mode::CyclicOnChange &&
+					(!state.ever_sent ||
+					 now >= state.last_tx + std::chrono::milliseconds(frame.min_interval));
+				hand_off(index, now, announce);
+			} else {
+				m_skipped++;
+			}
+			continue;
+		}
+
+		if (frame.mode == CanSignalMap::Mode::Cyclic)
+			continue;
+
+		if (!changed(index)) {
+			m_skipped++;
+			state.pending = false;
+			continue;
+		}
+
+		auto allowed = state.last_tx + std::chrono::milliseconds(frame.min_interval);
+		if (!state.ever_sent || now >= allowed)
+			emit(index, now);
+		else
+			state.pending = true;
+	}
+	m_map.clear_dirty();
+
+	service(now);
+}
+
+void CanTxScheduler::resend()
+{
+	auto &frames = m_map.frames();
+	auto now = clock::now();
+	for (std::size_t index = 0; index < m_state.size(); index++) {
+		const CanSignalMap::Frame &frame = frames[index];
+		FrameState &state = m_state[index];
+		if (!state.has_data)
+			continue;
+
+		state.ever_sent = false;
+		state.pending = false;
+		if (offloaded(frame))
+			hand_off(index, now, frame.mode == CanSignalMap::Mode::CyclicOnChange);
+		else if (frame.mode == CanSignalMap::Mode::OnChange)
+			emit(index, now);
+		else
+			state.next_cycle = now;
+	}
+
+	service(now);
+}
+
+void CanTxScheduler::service(clock::time_point now)
+{
+	auto &frames = m_map.frames();
+	for (std::size_t index = 0; index < m_state.size(); index++) {
+		const CanSignalMap::Frame &frame = frames[index];
+		FrameState &state = m_state[index];
+
+		if (state.pending &&
+		    now >= state.last_tx + std::chrono::milliseconds(frame.min_interval)) {
+			state.pending = false;
+			if (changed(index))
+				emit(index, now);
+		}
+
+		if (frame.mode != CanSignalMap::Mode::OnChange && !offloaded(frame) &&
+		    state.has_data && now >= state.next_cycle)
+			emit(index, now);
+	}
+
+	if (!m_batch.empty()) {
+		m_transmit(m_batch);
+		m_sent += m_batch.size();
+		m_batch.clear();
+	}
+
+	arm_timer();
+}
+
+void CanTxScheduler::on_timer(const boost::system::error_code &error)
+{
+	if (error)
+		return;
+
+	m_timer_armed = false;
+	service(clock::now());
+}
+
+void CanTxScheduler::arm_timer()
+{
+	// Wake up for the earliest cyclic deadline or held back update
+	auto &frames = m_map.frames();
+	bool armed = false;
+	clock::time_point deadline = clock::time_point::max();
+	for (std::size_t index = 0; index < m_state.size(); index++) {
+		const CanSignalMap::Frame &frame = frames[index];
+		const FrameState &state = m_state[index];
+
+		if (state.pending) {
+			deadline = std::min(deadline, state.last_tx + std::chrono::milliseconds(frame.min_interval));
+			armed = true;
+		}
+		if (frame.mode != CanSignalMap::Mode::OnChange && !offloaded(frame) && state.has_data) {
+			deadline = std::min(deadline, state.next_cycle);
+			armed = true;
+		}
+	}
+
+	// The expiry outlives a cancelled wait, so it only tells whether
+	// the outstanding one is still right.
+	if (!armed) {
+		if (m_timer_armed)
+			m_timer.cancel();
+		m_timer_armed = false;
+		return;
+	}
+	if (m_timer_armed && m_timer.expiry() == deadline)
+		return;
+
+	m_timer_armed = true;
+	m_timer.expires_at(deadline);
+	m_timer.async_wait(make_handler(m_handler_memory, [this](const boost::system::error_code &error) {
+		on_timer(error);
+	}));
+}
+
+bool CanTxScheduler::changed(std::size_t index) const
+{
+	const CanSignalMap::Frame &frame = m_map.frames()[index];
+	const FrameState &state = m_state[index];
+	return !state.ever_sent || memcmp(state.sent, frame.data, frame.dlc) != 0;
+}
+
+bool CanTxScheduler::offloaded(const CanSignalMap::Frame &frame) const
+{
+	return m_cyclic && frame.mode != CanSignalMap::Mode::OnChange;
+}
+
+void CanTxScheduler::hand_off(std::size_t index, clock::time_point now, bool announce)
+{
+	const CanSignalMap::Frame &frame = m_map.frames()[index];
+	FrameState &state = m_state[index];
+
+	struct can_frame out = {};
+	out.can_id = frame.id;
+	out.can_dlc = frame.dlc;
+	memcpy(out.data, frame.data, frame.dlc);
+	m_cyclic(out, frame.cycle_time, !state.ever_sent, announce);
+
+	memcpy(state.sent, frame.data, frame.dlc);
+	state.ever_sent = true;
+	if (announce) {
+		state.last_tx = now;
+		m_sent++;
+	}
+}
+
+void CanTxScheduler::emit(std::size_t index, clock::time_point now)
+{
+	const CanSignalMap::Frame &frame = m_map.frames()[index];
+	FrameState &state = m_state[index];
+
+	struct can_frame out = {};
+	out.can_id = frame.id;
+	out.can_dlc = frame.dlc;
+	memcpy(out.data, frame.data, frame.dlc);
+	m_batch.push_back(out);
+
+	memcpy(state.sent, frame.data, frame.dlc);
+	state.ever_sent = true;
+	state.pending = false;
+	state.last_tx = now;
+
+	if (frame.mode != CanSignalMap::Mode::OnChange) {
+		// Keep the cadence of cyclic frames unless we fell behind,
+		// an on-change transmission restarts the cycle.
+		auto cycle = std::chrono::milliseconds(frame.cycle_time);
+		if (frame.mode == CanSignalMap::Mode::CyclicOnChange || state.next_cycle + cycle <= now)
+			state.next_cycle = now + cycle;
+		else
+			state.next_cycle += cycle;
+	}
+}
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _CAN_TX_SCHEDULER_HPP
+#define _CAN_TX_SCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <linux/can.h>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "can-signal-map.hpp"
+#include "metrics.hpp"
+#include "handler-allocator.hpp"
+
+namespace net = boost::asio;
+
+// Decides when the frames of a CanSignalMap go out on the bus.  The map
+// holds the shadow payload of every frame, the scheduler remembers what
+// was last transmitted and, per frame mode:
+//
+//   on-change         sends when the payload differs from the last one
+//                     sent, at most once per min-interval
+//   cyclic            sends the current payload every cycle-time
+//   cyclic-on-change  both of the above
+//
+// Signal updates that arrive in the same batch of handlers are coalesced
+// into a single transmission per frame, so bus load is bounded by the
+// frame configuration rather than by the VIS update rate.
+//
+// The timing of cyclic frames can be handed off, e.g. to the kernel's
+// broadcast manager, by setting a cyclic handler.  It is then called
+// only when such a frame first gets content (setup) and when its
+// payload changes, with announce set if the change should also be sent
+// immediately.
+class CanTxScheduler
+{
+public:
+	typedef std::function<void(const std::vector<struct can_frame> &frames)> TransmitHandler;
+	typedef std::function<void(const struct can_frame &frame, unsigned cycle_time,
+				   bool setup, bool announce)> CyclicHandler;
+
+	CanTxScheduler(net::io_context &ioc, CanSignalMap &map, TransmitHandler transmit);
+
+	void set_cyclic_handler(CyclicHandler handler) { m_cyclic = handler; };
+
+	// Schedules the frames the map has marked dirty
+	void notify();
+
+	// Sends the current payload of every frame again, for when the
+	// transmit side lost its state, e.g. after reopening the socket
+	void resend();
+
+	uint64_t frames_sent() const { return m_sent; };
+	uint64_t frames_skipped() const { return m_skipped; };
+	uint64_t updates_coalesced() const { return m_coalesced; };
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct FrameState
+	{
+		uint8_t sent[CAN_MAX_DLEN];
+		bool has_data;		// a signal has been encoded into it
+		bool ever_sent;
+		bool pending;		// changed, held back by min-interval
+		clock::time_point last_tx;
+		clock::time_point next_cycle;
+	};
+
+	net::io_context &m_ioc;
+	CanSignalMap &m_map;
+	TransmitHandler m_transmit;
+	CyclicHandler m_cyclic;
+	net::steady_timer m_timer;
+	bool m_timer_armed;	// a wait is outstanding on m_timer
+	HandlerMemory &m_handler_memory;
+	bool m_flush_posted;
+	std::vector<FrameState> m_state;
+	std::vector<struct can_frame> m_batch;
+
+	Counter m_sent;
+	Counter m_skipped;
+	Counter m_coalesced;
+
+	void flush();
+
+	void service(clock::time_point now);
+
+	void on_timer(const boost::system::error_code &error);
+
+	void arm_timer();
+
+	bool changed(std::size_t index) const;
+
+	bool offloaded(const CanSignalMap::Frame &frame) const;
+
+	void hand_off(std::size_t index, clock::time_point now, bool announce);
+
+	void emit(std::size_t index, clock::time_point now);
+};
+
+#endif // _CAN_TX_SCHEDULER_HPP
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "handler-allocator.hpp"
+#include <new>
+
+HandlerMemory::~HandlerMemory()
+{
+	for (Block &block : m_blocks)
+		::operator delete(block.memory);
+}
+
+void *HandlerMemory::allocate(std::size_t size)
+{
+	// Prefer a free block that is large enough, otherwise grow one
+	Block *spare = nullptr;
+	for (Block &block : m_blocks) {
+		if (block.used)
+			continue;
+		if (block.size >= size) {
+			block.used = true;
+			return block.memory;
+		}
+		if (!spare)
+			spare = &block;
+	}
+
+	if (!spare) {
+		m_fallbacks++;
+		return ::operator new(size);
+	}
+	void *memory = ::operator new(size);
+	::operator delete(spare->memory);
+	spare->memory = memory;
+	spare->size = size;
+	spare->used = true;
+	return memory;
+}
+
+void HandlerMemory::deallocate(void *pointer)
+{
+	for (Block &block : m_blocks) {
+		if (block.memory == pointer) {
+			block.used = false;
+			return;
+		}
+	}
+	::operator delete(pointer);
+}
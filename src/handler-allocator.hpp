@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _HANDLER_ALLOCATOR_HPP
+#define _HANDLER_ALLOCATOR_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <boost/asio/execution_context.hpp>
+#include "metrics.hpp"
+
+namespace net = boost::asio;
+
+// Recycled memory for the operations asio allocates behind every
+// asynchronous call.  Boost.Asio 1.74 keeps only one spare block per
+// thread, so as soon as a read, a write and a posted handler are
+// outstanding together, some of them go to the heap on every cycle.
+//
+// The blocks here are kept and grown to the largest size asked for, so
+// that after the first few cycles the recurring operations of an
+// io_context are served without allocating.  There is one instance per
+// io_context, obtained with net::use_service(), and it lives as long as
+// the handlers it serves.  It must only be used from the thread running
+// that io_context.
+class HandlerMemory : public net::execution_context::service
+{
+public:
+	static inline net::execution_context::id id;
+
+	explicit HandlerMemory(net::execution_context &context) : net::execution_context::service(context) {};
+	~HandlerMemory();
+
+	void *allocate(std::size_t size);
+
+	void deallocate(void *pointer);
+
+	// Allocations that could not be served from a block
+	uint64_t fallbacks() const { return m_fallbacks; };
+
+private:
+	struct Block
+	{
+		void *memory = nullptr;
+		std::size_t size = 0;
+		bool used = false;
+	};
+
+	// More than are ever outstanding at once on the service's
+	// io_contexts, including the nested operations of a websocket read
+	std::array<Block, 16> m_blocks;
+	Counter m_fallbacks;
+
+	void shutdown() override {};
+};
+
+// Allocator for asio handlers drawing from a HandlerMemory
+template<typename T>
+class HandlerAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit HandlerAllocator(HandlerMemory &memory) : m_memory(&memory) {};
+
+	template<typename U>
+	HandlerAllocator(const HandlerAllocator<U> &other) : m_memory(other.m_memory) {};
+
+	T *allocate(std::size_t n) { return static_cast<T*>(m_memory->allocate(n * sizeof(T))); };
+
+	void deallocate(T *pointer, std::size_t) { m_memory->deallocate(pointer); };
+
+	template<typename U>
+	bool operator==(const HandlerAllocator<U> &other) const { return m_memory == other.m_memory; };
+
+	template<typename U>
+	bool operator!=(const HandlerAllocator<U> &other) const { return m_memory != other.m_memory; };
+
+private:
+	template<typename> friend class HandlerAllocator;
+
+	HandlerMemory *m_memory;
+};
+
+// Wraps a handler so that asio allocates its operation from a
+// HandlerMemory, found through the associated allocator
+template<typename Handler>
+class AllocatingHandler
+{
+public:
+	typedef HandlerAllocator<void> allocator_type;
+
+	AllocatingHandler(HandlerMemory &memory, Handler handler) :
+		m_memory(memory),
+		m_handler(std::move(handler))
+	{
+	};
+
+	allocator_type get_allocator() const noexcept { return allocator_type(m_memory); };
+
+	template<typename... Args>
+	void operator()(Args&&... args)
+	{
+		m_handler(std::forward<Args>(args)...);
+	};
+
+private:
+	HandlerMemory &m_memory;
+	Handler m_handler;
+};
+
+template<typename Handler>
+inline AllocatingHandler<std::decay_t<Handler>> make_handler(HandlerMemory &memory, Handler &&handler)
+{
+	return AllocatingHandler<std::decay_t<Handler>>(memory, std::forward<Handler>(handler));
+}
+
+#endif // _HANDLER_ALLOCATOR_HPP
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "latency-histogram.hpp"
+#include <chrono>
+
+LatencyHistogram::LatencyHistogram() :
+	m_count(0),
+	m_sum(0),
+	m_max(0)
+{
+	for (auto &bucket : m_buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+unsigned LatencyHistogram::bucket_index(uint64_t usec)
+{
+	// Values below SUB_BUCKETS map linearly, above that the top
+	// SUB_BUCKET_BITS bits below the leading one pick the sub-bucket
+	if (usec < SUB_BUCKETS)
+		return usec;
+	unsigned msb = 63 - __builtin_clzll(usec);
+	if (msb >= MAX_BITS)
+		return BUCKETS - 1;
+	unsigned shift = msb - SUB_BUCKET_BITS;
+	unsigned sub = (usec >> shift) & (SUB_BUCKETS - 1);
+	return (shift + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucket_limit(unsigned index)
+{
+	if (index < SUB_BUCKETS)
+		return index;
+	unsigned shift = index / SUB_BUCKETS - 1;
+	uint64_t sub = index % SUB_BUCKETS;
+	return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t usec)
+{
+	m_buckets[bucket_index(usec)].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(usec, std::memory_order_relaxed);
+
+	uint64_t max = m_max.load(std::memory_order_relaxed);
+	while (usec > max && !m_max.compare_exchange_weak(max, usec, std::memory_order_relaxed))
+		;
+}
+
+uint64_t LatencyHistogram::quantile(double q) const
+{
+	uint64_t total = count();
+	if (total == 0)
+		return 0;
+
+	uint64_t rank = q * total;
+	if (rank >= total)
+		rank = total - 1;
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < BUCKETS; i++) {
+		seen += bucket_count(i);
+		if (seen > rank)
+			return std::min(bucket_limit(i), max());
+	}
+	return max();
+}
+
+LatencyTracker::LatencyTracker() :
+	m_signals(new std::atomic<SignalHistograms*>[MAX_SIGNALS])
+{
+	for (std::size_t i = 0; i < MAX_SIGNALS; i++)
+		m_signals[i].store(nullptr, std::memory_order_relaxed);
+}
+
+LatencyTracker::~LatencyTracker()
+{
+	for (std::size_t i = 0; i < MAX_SIGNALS; i++)
+		delete m_signals[i].load(std::memory_order_relaxed);
+}
+
+LatencyTracker::SignalHistograms *LatencyTracker::get(VisSignalId signal)
+{
+	if (signal >= MAX_SIGNALS)
+		return nullptr;
+
+	SignalHistograms *histograms = m_signals[signal].load(std::memory_order_acquire);
+	if (!histograms) {
+		// Used from more than one thread, the loser of the race
+		// frees its copy
+		SignalHistograms *fresh = new SignalHistograms;
+		if (m_signals[signal].compare_exchange_strong(histograms, fresh, std::memory_order_acq_rel))
+			histograms = fresh;
+		else
+			delete fresh;
+	}
+	return histograms;
+}
+
+void LatencyTracker::record(VisSignalId signal, Stage stage, int64_t nsec)
+{
+	SignalHistograms *histograms = get(signal);
+	if (histograms)
+		histograms->stages[stage].record(nsec > 0 ? nsec / 1000 : 0);
+}
+
+const LatencyHistogram *LatencyTracker::histogram(VisSignalId signal, Stage stage)
+{
+	SignalHistograms *histograms = get(signal);
+	return histograms ? &histograms->stages[stage] : nullptr;
+}
+
+const char *LatencyTracker::stage_name(Stage stage)
+{
+	static const char *names[] = { "server_to_receive", "receive_to_dispatch", "dispatch_to_send" };
+	return names[stage];
+}
+
+int64_t monotonic_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t realtime_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _LATENCY_HISTOGRAM_HPP
+#define _LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "vis-signal-table.hpp"
+
+// Log-linear histogram of durations in microseconds, in the style of
+// HdrHistogram: each power of two range is split into SUB_BUCKETS linear
+// buckets, so values are kept to within about 12% up to ~70 minutes.
+// Recording is a relaxed atomic increment, so any thread may record and
+// read concurrently.
+class LatencyHistogram
+{
+public:
+	static const unsigned SUB_BUCKET_BITS = 3;
+	static const unsigned SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const unsigned MAX_BITS = 32;
+	static const unsigned BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	LatencyHistogram();
+
+	void record(uint64_t usec);
+
+	uint64_t count() const { return m_count.load(std::memory_order_relaxed); };
+	uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); };
+	uint64_t max() const { return m_max.load(std::memory_order_relaxed); };
+
+	// Upper bound of the bucket holding the q-th quantile (0..1)
+	uint64_t quantile(double q) const;
+
+	// Upper bound of bucket index, and its count
+	static uint64_t bucket_limit(unsigned index);
+	uint64_t bucket_count(unsigned index) const { return m_buckets[index].load(std::memory_order_relaxed); };
+
+private:
+	std::atomic<uint64_t> m_buckets[BUCKETS];
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sum;
+	std::atomic<uint64_t> m_max;
+
+	static unsigned bucket_index(uint64_t usec);
+};
+
+// Per-signal latency histograms for the stages between a value being
+// stamped by the VSS server and its frame being written to the bus.
+// Histograms are allocated on first use, for signal IDs below
+// MAX_SIGNALS.
+class LatencyTracker
+{
+public:
+	enum Stage {
+		ServerToReceive,	// dp.ts to the websocket read
+		ReceiveToDispatch,	// read to encoding on the CAN side
+		DispatchToSend,		// encoding to the frame's sendto
+		STAGES
+	};
+
+	static const std::size_t MAX_SIGNALS = 4096;
+
+	LatencyTracker();
+
+	~LatencyTracker();
+
+	// Records a duration in nanoseconds, negative ones count as zero
+	void record(VisSignalId signal, Stage stage, int64_t nsec);
+
+	// Histogram of a signal's stage, nullptr if the signal ID is out
+	// of range
+	const LatencyHistogram *histogram(VisSignalId signal, Stage stage);
+
+	static const char *stage_name(Stage stage);
+
+private:
+	struct SignalHistograms
+	{
+		LatencyHistogram stages[STAGES];
+	};
+
+	std::unique_ptr<std::atomic<SignalHistograms*>[]> m_signals;
+
+	SignalHistograms *get(VisSignalId signal);
+};
+
+// Monotonic and wall clock in nanoseconds
+int64_t monotonic_ns();
+int64_t realtime_ns();
+
+#endif // _LATENCY_HISTOGRAM_HPP
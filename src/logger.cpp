@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <systemd/sd-journal.h>
+
+// Records written per batch before checking for new ones
+#define WRITE_BATCH 64
+// Upper bound on how long a message may sit in the ring if a wakeup
+// is missed
+#define WRITER_TIMEOUT std::chrono::milliseconds(100)
+
+static const char *component_name(LogComponent component)
+{
+	switch (component) {
+	case LogComponent::Vis:
+		return "vis";
+	case LogComponent::Can:
+		return "can";
+	case LogComponent::Metrics:
+		return "metrics";
+	default:
+		return nullptr;
+	}
+}
+
+// stderr is connected to the journal if it matches the device and inode
+// systemd passes in JOURNAL_STREAM
+static bool stderr_is_journal()
+{
+	const char *stream = getenv("JOURNAL_STREAM");
+	if (!stream)
+		return false;
+
+	unsigned long long device, inode;
+	if (sscanf(stream, "%llu:%llu", &device, &inode) != 2)
+		return false;
+
+	struct stat st;
+	if (fstat(STDERR_FILENO, &st) < 0)
+		return false;
+	return st.st_dev == device && st.st_ino == inode;
+}
+
+Logger &Logger::instance()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger() :
+	m_records(new Record[CAPACITY]),
+	m_journal(stderr_is_journal())
+{
+	for (std::size_t i = 0; i < CAPACITY; i++)
+		m_records[i].sequence.store(i, std::memory_order_relaxed);
+	for (auto &level : m_levels)
+		level.store(LogLevel::Info, std::memory_order_relaxed);
+
+	m_thread = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+void Logger::set_verbosity(LogComponent component, unsigned verbose)
+{
+	if (verbose == 0)
+		set_level(component, LogLevel::Notice);
+	else if (verbose == 1)
+		set_level(component, LogLevel::Info);
+	else
+		set_level(component, LogLevel::Debug);
+}
+
+// Bounded multi-producer queue: a slot is free for position p when its
+// sequence is p, and holds a committed record when it is p + 1.
+Logger::Record *Logger::claim()
+{
+	std::size_t position = m_tail.load(std::memory_order_relaxed);
+	for (;;) {
+		Record &record = m_records[position & (CAPACITY - 1)];
+		std::size_t sequence = record.sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (diff == 0) {
+			if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				return &record;
+		} else if (diff < 0) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		} else {
+			position = m_tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void Logger::commit(Record *record)
+{
+	std::size_t sequence = record->sequence.load(std::memory_order_relaxed);
+	record->sequence.store(sequence + 1, std::memory_order_release);
+
+	// Pairs with the fence in run(), either the writer sees the record
+	// or we see it sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_sleeping.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_wake.notify_one();
+	}
+}
+
+void Logger::run()
+{
+	for (;;) {
+		if (write_pending())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_stop)
+			break;
+		m_sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const Record &next = m_records[m_head & (CAPACITY - 1)];
+		if (next.sequence.load(std::memory_order_acquire) != m_head + 1)
+			m_wake.wait_for(lock, WRITER_TIMEOUT);
+		m_sleeping.store(false, std::memory_order_relaxed);
+	}
+}
+
+bool Logger::write_pending()
+{
+	unsigned written = 0;
+	while (written < WRITE_BATCH) {
+		Record &record = m_records[m_head & (CAPACITY - 1)];
+		if (record.sequence.load(std::memory_order_acquire) != m_head + 1)
+			break;
+		write(record);
+		record.sequence.store(m_head + CAPACITY, std::memory_order_release);
+		m_head++;
+		written++;
+	}
+
+	uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+	if (dropped != m_dropped_reported) {
+		char text[64];
+		int length = snprintf(text, sizeof(text), "Logger - %llu messages dropped",
+				      static_cast<unsigned long long>(dropped - m_dropped_reported));
+		write(LogLevel::Warning, LogComponent::Count, __FILE__, __LINE__, __func__, text, length);
+		m_dropped_reported = dropped;
+	}
+	flush_output();
+	return written > 0;
+}
+
+void Logger::write(const Record &record)
+{
+	write(record.level, record.component, record.file, record.line, record.function,
+	      record.text, record.length);
+}
+
+void Logger::write(LogLevel level, LogComponent component, const char *file, unsigned line,
+		   const char *function, const char *text, std::size_t length)
+{
+	if (m_journal) {
+		char message[TEXT_SIZE + 8];
+		char priority[16];
+		char code_file[256];
+		char code_line[32];
+		char code_func[128];
+		char component_field[32];
+		struct iovec iov[6];
+		int n = 0;
+
+		memcpy(message, "MESSAGE=", 8);
+		memcpy(message + 8, text, length);
+		iov[n++] = { message, 8 + length };
+		iov[n].iov_base = priority;
+		iov[n++].iov_len = snprintf(priority, sizeof(priority), "PRIORITY=%d", static_cast<int>(level));
+		iov[n].iov_base = code_file;
+		iov[n++].iov_len = std::min(sizeof(code_file) - 1,
+					    static_cast<std::size_t>(snprintf(code_file, sizeof(code_file), "CODE_FILE=%s", file)));
+		iov[n].iov_base = code_line;
+		iov[n++].iov_len = snprintf(code_line, sizeof(code_line), "CODE_LINE=%u", line);
+		iov[n].iov_base = code_func;
+		iov[n++].iov_len = std::min(sizeof(code_func) - 1,
+					    static_cast<std::size_t>(snprintf(code_func, sizeof(code_func), "CODE_FUNC=%s", function)));
+		const char *name = component_name(component);
+		if (name) {
+			iov[n].iov_base = component_field;
+			iov[n++].iov_len = snprintf(component_field, sizeof(component_field), "COMPONENT=%s", name);
+		}
+		if (sd_journal_sendv(iov, n) >= 0)
+			return;
+	}
+
+	if (m_output_length + length + 1 > sizeof(m_output))
+		flush_output();
+	memcpy(m_output + m_output_length, text, length);
+	m_output[m_output_length + length] = '\n';
+	m_output_length += length + 1;
+}
+
+void Logger::flush_output()
+{
+	const char *data = m_output;
+	while (m_output_length > 0) {
+		ssize_t n = ::write(STDERR_FILENO, data, m_output_length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		data += n;
+		m_output_length -= n;
+	}
+	m_output_length = 0;
+}
+
+// Each thread formats through its own stream
+static LogStream &log_stream()
+{
+	static thread_local LogStream stream;
+	return stream;
+}
+
+LogLine::LogLine(LogComponent component, LogLevel level, const char *file, unsigned line, const char *function) :
+	m_record(Logger::instance().claim()),
+	m_stream(log_stream())
+{
+	if (!m_record)
+		return;
+
+	m_record->level = level;
+	m_record->component = component;
+	m_record->file = file;
+	m_record->line = line;
+	m_record->function = function;
+	m_stream.reset(m_record->text, sizeof(m_record->text));
+}
+
+LogLine::~LogLine()
+{
+	if (!m_record)
+		return;
+
+	m_record->length = m_stream.length();
+	Logger::instance().commit(m_record);
+}
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _LOGGER_HPP
+#define _LOGGER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+
+// Levels are syslog priorities, lower is more severe
+enum class LogLevel { Error = 3, Warning = 4, Notice = 5, Info = 6, Debug = 7 };
+
+// Parts of the service with their own verbosity setting
+enum class LogComponent { Vis, Can, Metrics, Count };
+
+// Messages above this level are compiled out, see the log-level option
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 7
+#endif
+
+// Records are formatted on the calling thread straight into a slot of a
+// lock-free ring, and written to the journal (or stderr when not run
+// under systemd) by a background thread.  Logging never blocks or
+// allocates; when the ring is full messages are dropped and counted.
+class Logger
+{
+public:
+	static constexpr std::size_t TEXT_SIZE = 480;
+	static constexpr std::size_t CAPACITY = 1024;
+
+	struct Record
+	{
+		std::atomic<std::size_t> sequence;
+		LogLevel level;
+		LogComponent component;
+		unsigned line;
+		const char *file;
+		const char *function;
+		std::size_t length;
+		char text[TEXT_SIZE];
+	};
+
+	static Logger &instance();
+
+	~Logger();
+
+	bool enabled(LogComponent component, LogLevel level) const
+	{
+		return level <= m_levels[static_cast<int>(component)].load(std::memory_order_relaxed);
+	}
+
+	void set_level(LogComponent component, LogLevel level)
+	{
+		m_levels[static_cast<int>(component)].store(level, std::memory_order_relaxed);
+	}
+
+	// Maps the verbose setting of the configuration files: 0 keeps
+	// notices and worse, 1 adds informational messages, 2 debugging.
+	void set_verbosity(LogComponent component, unsigned verbose);
+
+	// Claims a slot to format a message into, nullptr if the ring is
+	// full.  Every claimed slot must be committed.
+	Record *claim();
+	void commit(Record *record);
+
+	uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); };
+
+private:
+	Logger();
+
+	std::unique_ptr<Record[]> m_records;
+	alignas(64) std::atomic<std::size_t> m_tail{0};	// producers
+	alignas(64) std::size_t m_head = 0;		// consumer
+	std::atomic<LogLevel> m_levels[static_cast<int>(LogComponent::Count)];
+	std::atomic<uint64_t> m_dropped{0};
+	uint64_t m_dropped_reported = 0;
+
+	// The writer sleeps on the condition variable when the ring is
+	// empty, producers only take the mutex if it is sleeping.
+	std::atomic<bool> m_sleeping{false};
+	bool m_stop = false;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_journal;
+	// Lines for stderr are gathered and written once per batch
+	char m_output[8192];
+	std::size_t m_output_length = 0;
+	std::thread m_thread;
+
+	void run();
+	bool write_pending();
+	void write(const Record &record);
+	void write(LogLevel level, LogComponent component, const char *file, unsigned line,
+		   const char *function, const char *text, std::size_t length);
+	void flush_output();
+};
+
+// Stream writing into a fixed buffer, output beyond it is cut off
+class LogStream : private std::streambuf, public std::ostream
+{
+public:
+	LogStream() : std::ostream(this) {};
+
+	void reset(char *buffer, std::size_t size)
+	{
+		setp(buffer, buffer + size);
+		clear();
+		flags(std::ios_base::dec | std::ios_base::skipws);
+		precision(6);
+		fill(' ');
+	}
+
+	std::size_t length() const { return pptr() - pbase(); };
+};
+
+// One message being formatted, committed when it goes out of scope
+class LogLine
+{
+	Logger::Record *m_record;
+	LogStream &m_stream;
+
+public:
+	LogLine(LogComponent component, LogLevel level, const char *file, unsigned line, const char *function);
+	~LogLine();
+
+	explicit operator bool() const { return m_record != nullptr; };
+	std::ostream &stream() { return m_stream; };
+};
+
+// The message is a stream expression, only evaluated when enabled:
+// LOG_INFO(LogComponent::Can, "Reopened " << m_port);
+#define LOG_AT(component, level, message) \
+	do { \
+		if (static_cast<int>(level) <= LOG_COMPILE_LEVEL && \
+		    Logger::instance().enabled(component, level)) { \
+			LogLine log_line_(component, level, __FILE__, __LINE__, __func__); \
+			if (log_line_) \
+				log_line_.stream() << message; \
+		} \
+	} while (0)
+
+#define LOG_ERROR(component, message) LOG_AT(component, LogLevel::Error, message)
+#define LOG_WARNING(component, message) LOG_AT(component, LogLevel::Warning, message)
+#define LOG_NOTICE(component, message) LOG_AT(component, LogLevel::Notice, message)
+#define LOG_INFO(component, message) LOG_AT(component, LogLevel::Info, message)
+#define LOG_DEBUG(component, message) LOG_AT(component, LogLevel::Debug, message)
+
+#endif // _LOGGER_HPP
@@ -4,12 +4,38 @@
 #include <iomanip>
 #include <boost/asio/signal_set.hpp>
 #include <boost/bind.hpp>
+#include <boost/program_options.hpp>
 #include "monitor-service.hpp"
+#include "vis-replay.hpp"
+
+namespace po = boost::program_options;
 
 using work_guard_type = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
 
 int main(int argc, char** argv)
 {
+	po::options_description options("Options");
+	options.add_options()
+		("help,h", "Show this help")
+		("replay", po::value<std::string>(), "Replay a capture file instead of connecting to the VIS server")
+		("speed", po::value<double>()->default_value(1.0), "Replay speed factor, 0 for as fast as possible");
+	po::variables_map vm;
+	try {
+		po::store(po::parse_command_line(argc, argv, options), vm);
+		po::notify(vm);
+	} catch (const po::error &ex) {
+		std::cerr << ex.what() << std::endl << options << std::endl;
+		return 1;
+	}
+	if (vm.count("help")) {
+		std::cout << options << std::endl;
+		return 0;
+	}
+	if (vm["speed"].as<double>() < 0) {
+		std::cerr << "Invalid replay speed" << std::endl;
+		return 1;
+	}
+
 	// The io_context is required for all I/O
 	net::io_context ioc;
 
@@ -22,7 +48,19 @@ int main(int argc, char** argv)
 
 	// Launch the asynchronous operation
 	VisConfig config("agl-service-monitor");
-	std::make_shared<MonitorService>(config, ioc, ctx)->run();
+	auto service = std::make_shared<MonitorService>(config, ioc, ctx);
+	std::unique_ptr<VisReplay> replay;
+	if (vm.count("replay")) {
+		// Stop once the replayed messages have been handled
+		replay = std::make_unique<VisReplay>(ioc, service, vm["speed"].as<double>());
+		if (!replay->open(vm["replay"].as<std::string>()))
+			return 1;
+		replay->start([&ioc]() {
+			net::post(ioc, [&ioc]() { ioc.stop(); });
+		});
+	} else {
+		service->run();
+	}
 
 	// Ensure I/O context continues running even if there's no work
 	work_guard_type work_guard(ioc.get_executor());
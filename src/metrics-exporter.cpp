@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "metrics-exporter.hpp"
+#include "logger.hpp"
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace property_tree = boost::property_tree;
+
+#define DEFAULT_SNAPSHOT_INTERVAL 60
+
+MetricsExporter::MetricsExporter(net::io_context &ioc, const MetricsRegistry &registry) :
+	m_registry(registry),
+	m_acceptor(ioc),
+	m_snapshot_timer(ioc),
+	m_snapshot_interval(DEFAULT_SNAPSHOT_INTERVAL)
+{
+	read_config();
+
+	if (!m_socket_path.empty())
+		listen();
+	if (!m_snapshot_path.empty())
+		schedule_snapshot();
+}
+
+MetricsExporter::~MetricsExporter()
+{
+	if (m_acceptor.is_open())
+		unlink(m_socket_path.c_str());
+}
+
+void MetricsExporter::read_config()
+{
+	std::string config("/etc/xdg/AGL/agl-service-monitor.conf");
+	char *home = getenv("XDG_CONFIG_HOME");
+	if (home) {
+		config = home;
+		config += "/AGL/agl-service-monitor.conf";
+	}
+
+	property_tree::ptree pt;
+	try {
+		property_tree::ini_parser::read_ini(config, pt);
+	}
+	catch (std::exception &ex) {
+		return;
+	}
+	const property_tree::ptree empty;
+	const property_tree::ptree &settings = pt.get_child("metrics", empty);
+
+	m_socket_path = settings.get("socket", "");
+	m_snapshot_path = settings.get("snapshot", "");
+	m_snapshot_interval = settings.get("snapshot-interval", DEFAULT_SNAPSHOT_INTERVAL);
+	if (m_snapshot_interval == 0)
+		m_snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+}
+
+void MetricsExporter::listen()
+{
+	// A stale socket from a previous run would make bind fail
+	unlink(m_socket_path.c_str());
+
+	boost::system::error_code ec;
+	net::local::stream_protocol::endpoint endpoint(m_socket_path);
+	m_acceptor.open(endpoint.protocol(), ec);
+	if (!ec)
+		m_acceptor.bind(endpoint, ec);
+	if (!ec)
+		m_acceptor.listen(net::socket_base::max_listen_connections, ec);
+	if (ec) {
+		LOG_ERROR(LogComponent::Metrics, "Could not listen for metrics on " << m_socket_path << ": " << ec.message());
+		m_acceptor.close(ec);
+		return;
+	}
+	do_accept();
+}
+
+void MetricsExporter::do_accept()
+{
+	auto socket = std::make_shared<socket_type>(m_acceptor.get_executor());
+	m_acceptor.async_accept(*socket, [this, socket](const boost::system::error_code &error) {
+		if (error == net::error::operation_aborted)
+			return;
+		if (!error)
+			serve(socket);
+		do_accept();
+	});
+}
+
+void MetricsExporter::serve(std::shared_ptr<socket_type> socket)
+{
+	// One request per connection, any path gets the metrics, e.g.
+	// curl --unix-socket <socket> http://localhost/metrics
+	struct Exchange
+	{
+		beast::flat_buffer buffer;
+		http::request<http::empty_body> request;
+		http::response<http::string_body> response;
+	};
+	auto exchange = std::make_shared<Exchange>();
+
+	http::async_read(*socket, exchange->buffer, exchange->request,
+			 [this, socket, exchange](beast::error_code error, std::size_t) {
+		if (error)
+			return;
+
+		auto &response = exchange->response;
+		response.version(exchange->request.version());
+		response.result(http::status::ok);
+		response.set(http::field::content_type, "text/plain; version=0.0.4");
+		response.keep_alive(false);
+		if (exchange->request.method() != http::verb::head)
+			response.body() = m_registry.render();
+		response.prepare_payload();
+
+		http::async_write(*socket, response,
+				  [socket, exchange](beast::error_code, std::size_t) {
+			beast::error_code ec;
+			socket->shutdown(socket_type::shutdown_send, ec);
+		});
+	});
+}
+
+void MetricsExporter::schedule_snapshot()
+{
+	m_snapshot_timer.expires_after(std::chrono::seconds(m_snapshot_interval));
+	m_snapshot_timer.async_wait([this](const boost::system::error_code &error) {
+		if (error)
+			return;
+		write_snapshot();
+		schedule_snapshot();
+	});
+}
+
+void MetricsExporter::write_snapshot()
+{
+	// Written aside and renamed, so readers never see a partial file
+	std::string temp = m_snapshot_path + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::trunc);
+		out << m_registry.render();
+		if (!out) {
+			LOG_ERROR(LogComponent::Metrics, "Could not write metrics snapshot " << temp);
+			return;
+		}
+	}
+	if (rename(temp.c_str(), m_snapshot_path.c_str()) < 0)
+		LOG_ERROR(LogComponent::Metrics, "Could not write metrics snapshot " << m_snapshot_path);
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _METRICS_EXPORTER_HPP
+#define _METRICS_EXPORTER_HPP
+
+#include <memory>
+#include <string>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "metrics.hpp"
+
+namespace net = boost::asio;
+
+// Serves a MetricsRegistry over HTTP on a Unix socket and/or writes it
+// to a file periodically, as configured in the [metrics] section:
+//
+//   [metrics]
+//   socket=/run/agl-service-monitor/metrics.sock
+//   snapshot=/var/lib/node_exporter/agl-service-monitor.prom
+//   snapshot-interval=60
+//
+// Both are off unless configured.
+class MetricsExporter
+{
+public:
+	MetricsExporter(net::io_context &ioc, const MetricsRegistry &registry);
+
+	~MetricsExporter();
+
+private:
+	typedef net::local::stream_protocol::socket socket_type;
+
+	const MetricsRegistry &m_registry;
+	net::local::stream_protocol::acceptor m_acceptor;
+	net::steady_timer m_snapshot_timer;
+	std::string m_socket_path;
+	std::string m_snapshot_path;
+	unsigned m_snapshot_interval;
+
+	void read_config();
+
+	void listen();
+
+	void do_accept();
+
+	void serve(std::shared_ptr<socket_type> socket);
+
+	void schedule_snapshot();
+
+	void write_snapshot();
+};
+
+#endif // _METRICS_EXPORTER_HPP
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "metrics.hpp"
+#include <algorithm>
+#include <cstdio>
+
+// Histogram buckets exported, in microseconds
+static const uint64_t export_buckets[] = {
+	10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+};
+
+static void append_number(std::string &out, double value)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.17g", value);
+	out += buf;
+}
+
+static void append_name(std::string &out, const std::string &name, const char *suffix,
+			const std::string &labels, const char *extra = nullptr)
+{
+	out += name;
+	out += suffix;
+	if (labels.empty() && !extra)
+		return;
+	out += '{';
+	out += labels;
+	if (extra) {
+		if (!labels.empty())
+			out += ',';
+		out += extra;
+	}
+	out += '}';
+}
+
+MetricsRegistry::Series &MetricsRegistry::series(Type type, const std::string &name,
+						 const std::string &help, const std::string &labels)
+{
+	Family *family = nullptr;
+	for (auto &f : m_families) {
+		if (f.name == name)
+			family = &f;
+	}
+	if (!family) {
+		m_families.push_back(Family{name, help, type, {}});
+		family = &m_families.back();
+	}
+
+	for (auto &s : family->series) {
+		if (s.labels == labels)
+			return s;
+	}
+	family->series.push_back(Series{labels, nullptr, nullptr});
+	return family->series.back();
+}
+
+void MetricsRegistry::add(Type type, const std::string &name, const std::string &help,
+			  const std::string &labels, Sampler sampler)
+{
+	series(type, name, help, labels).sampler = sampler;
+}
+
+void MetricsRegistry::add_histogram(const std::string &name, const std::string &help,
+				    const std::string &labels, const LatencyHistogram *histogram)
+{
+	series(Type::Histogram, name, help, labels).histogram = histogram;
+}
+
+std::string MetricsRegistry::label(const std::string &name, const std::string &value)
+{
+	std::string out = name;
+	out += "=\"";
+	for (char c : value) {
+		if (c == '\\' || c == '"')
+			out += '\\';
+		if (c == '\n') {
+			out += "\\n";
+			continue;
+		}
+		out += c;
+	}
+	out += '"';
+	return out;
+}
+
+std::string MetricsRegistry::render() const
+{
+	static const char *types[] = { "counter", "gauge", "histogram" };
+
+	std::string out;
+	for (auto &family : m_families) {
+		out += "# HELP ";
+		out += family.name;
+		out += ' ';
+		out += family.help;
+		out += "\n# TYPE ";
+		out += family.name;
+		out += ' ';
+		out += types[static_cast<unsigned>(family.type)];
+		out += '\n';
+
+		for (auto &s : family.series) {
+			if (family.type != Type::Histogram) {
+				append_name(out, family.name, "", s.labels);
+				out += ' ';
+				append_number(out, s.sampler ? s.sampler() : 0.0);
+				out += '\n';
+				continue;
+			}
+
+			// Histograms are kept in microseconds and exported in
+			// seconds, with cumulative counts at fixed bounds
+			const LatencyHistogram *h = s.histogram;
+			unsigned index = 0;
+			uint64_t cumulative = 0;
+			for (uint64_t bound : export_buckets) {
+				while (index < LatencyHistogram::BUCKETS &&
+				       LatencyHistogram::bucket_limit(index) <= bound)
+					cumulative += h->bucket_count(index++);
+				char le[32];
+				snprintf(le, sizeof(le), "le=\"%g\"", bound / 1e6);
+				append_name(out, family.name, "_bucket", s.labels, le);
+				out += ' ';
+				append_number(out, cumulative);
+				out += '\n';
+			}
+			uint64_t count = std::max(h->count(), cumulative);
+			append_name(out, family.name, "_bucket", s.labels, "le=\"+Inf\"");
+			out += ' ';
+			append_number(out, count);
+			out += '\n';
+			append_name(out, family.name, "_sum", s.labels);
+			out += ' ';
+			append_number(out, h->sum() / 1e6);
+			out += '\n';
+			append_name(out, family.name, "_count", s.labels);
+			out += ' ';
+			append_number(out, count);
+			out += '\n';
+		}
+	}
+	return out;
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _METRICS_HPP
+#define _METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "latency-histogram.hpp"
+
+// Event counter with a single writing thread.  Incrementing is a plain
+// load and store, no locked instruction, while other threads can still
+// read a consistent value.
+class Counter
+{
+public:
+	Counter(uint64_t value = 0) : m_value(value) {};
+
+	void operator++(int) { *this += 1; };
+	Counter &operator+=(uint64_t n)
+	{
+		m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		return *this;
+	};
+	operator uint64_t() const { return m_value.load(std::memory_order_relaxed); };
+
+private:
+	std::atomic<uint64_t> m_value;
+};
+
+// Named metrics rendered in the Prometheus text exposition format.
+// Nothing is recorded through the registry itself: it samples the
+// owners' counters, gauges and histograms when rendering, so the hot
+// paths only ever touch their own counters.
+class MetricsRegistry
+{
+public:
+	enum class Type { Counter, Gauge, Histogram };
+
+	typedef std::function<double()> Sampler;
+
+	// Adds a sampled counter or gauge, labels in Prometheus syntax
+	// without braces, e.g. path="Vehicle.Speed".  Adding an existing
+	// name and labels replaces it.
+	void add(Type type, const std::string &name, const std::string &help,
+		 const std::string &labels, Sampler sampler);
+
+	void add_histogram(const std::string &name, const std::string &help,
+			   const std::string &labels, const LatencyHistogram *histogram);
+
+	std::string render() const;
+
+	// Quotes and escapes a label value
+	static std::string label(const std::string &name, const std::string &value);
+
+private:
+	struct Series
+	{
+		std::string labels;
+		Sampler sampler;
+		const LatencyHistogram *histogram;
+	};
+
+	struct Family
+	{
+		std::string name;
+		std::string help;
+		Type type;
+		std::vector<Series> series;
+	};
+
+	std::vector<Family> m_families;
+
+	Series &series(Type type, const std::string &name, const std::string &help, const std::string &labels);
+};
+
+#endif // _METRICS_HPP
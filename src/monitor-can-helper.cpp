@@ -1,38 +1,96 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "monitor-can-helper.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <cerrno>
+#include <cstring>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <linux/can/bcm.h>
+#include <linux/can/raw.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <boost/asio/post.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 
 namespace property_tree = boost::property_tree;
 
-MonitorCanHelper::MonitorCanHelper() :
-	m_level(30),
-	// m_pressure(800.0),
+#define DEFAULT_TX_QUEUE_LIMIT 64
+#define DEFAULT_REOPEN_INTERVAL 1000
+#define MIN_TX_BACKOFF 1U
+#define MAX_TX_BACKOFF 128U
+#define RX_BATCH 32
+
+MonitorCanHelper::MonitorCanHelper(net::io_context &ioc) :
+	m_vis_ioc(ioc),
+	m_thread_config(read_thread_config()),
+	m_thread_ioc(1),
+	m_ioc(m_thread_config.enabled ? m_thread_ioc : ioc),
+	m_wake(m_ioc),
+	m_handler_memory(net::use_service<HandlerMemory>(m_ioc)),
 	m_port("can0"),
+	m_verbose(1),
 	m_config_valid(false),
 	m_active(false),
-	m_verbose(1)
+	m_can_stream(m_ioc),
+	m_backoff_timer(m_ioc),
+	m_netlink(m_ioc),
+	m_reopen_timer(m_ioc),
+	m_publisher(m_ioc, [this](VisSignalId signal, const VisValue &value) {
+		if (!m_thread_config.enabled) {
+			if (m_publish)
+				m_publish(signal, value);
+			return;
+		}
+		// Decoded values hold no strings, so they can be copied
+		// over to the VIS thread
+		net::post(m_vis_ioc, [this, signal, value]() {
+			if (m_publish)
+				m_publish(signal, value);
+		});
+	}),
+	m_use_bcm(false),
+	m_bcm_socket(-1),
+	m_scheduler(m_ioc, m_map,
+		    [this](const std::vector<struct can_frame> &frames) { can_transmit(frames); })
 {
 	read_config();
+	Logger::instance().set_verbosity(LogComponent::Can, m_verbose);
+
+	if (!m_config_valid)
+		return;
+
+	m_pending.set_capacity(m_tx_queue_limit);
+	netlink_open();
+	if (!can_open())
+		schedule_reopen();
 
-	can_open();
+	if (m_thread_config.enabled)
+		thread_start();
 }
 
 MonitorCanHelper::~MonitorCanHelper()
 {
+	if (m_thread.joinable()) {
+		m_thread_ioc.stop();
+		m_thread.join();
+	}
 	can_close();
 }
 
-void MonitorCanHelper::read_config()
+static std::string config_file()
 {
 	// Using a separate configuration file now, it may make sense
 	// to revisit this if a workable scheme to handle overriding
@@ -43,7 +101,38 @@ void MonitorCanHelper::read_config()
 		config = home;
 		config += "/AGL/agl-service-monitor.conf";
 	}
+	return config;
+}
+
+CanThreadConfig MonitorCanHelper::read_thread_config()
+{
+	// Read ahead of the rest of the configuration, as it decides
+	// which io_context everything else is created on
+	CanThreadConfig config = { false, 0, -1, false };
+	property_tree::ptree pt;
+	try {
+		property_tree::ini_parser::read_ini(config_file(), pt);
+	}
+	catch (std::exception &ex) {
+		return config;
+	}
+	const property_tree::ptree empty;
+	const property_tree::ptree &settings = pt.get_child("can", empty);
 
+	auto flag = [&settings](const char *key) {
+		std::string value = settings.get(key, "false");
+		return value == "true" || value == "1";
+	};
+	config.enabled = flag("thread");
+	config.lock_memory = flag("lock-memory");
+	config.priority = settings.get("thread-priority", 0);
+	config.cpu = settings.get("thread-cpu", -1);
+	return config;
+}
+
+void MonitorCanHelper::read_config()
+{
+	std::string config = config_file();
 
 	std::cout << "Can Helper - Using configuration " << config << std::endl;
 	property_tree::ptree pt;
@@ -55,11 +144,11 @@ void MonitorCanHelper::read_config()
 	catch (std::exception &ex) {
 		// Continue with defaults if file missing/broken
 		std::cerr << "Could not read " << config << std::endl;
-		m_config_valid = true;
+		m_config_valid = m_map.load(pt);
 		return;
 	}
-	const property_tree::ptree &settings =
-		pt.get_child("can", property_tree::ptree());
+	const property_tree::ptree empty;
+	const property_tree::ptree &settings = pt.get_child("can", empty);
 
 	m_port = settings.get("port", "can0");
 	std::stringstream ss;
@@ -82,118 +171,649 @@ void MonitorCanHelper::read_config()
 			m_verbose = 2;
 	}
 
+	m_tx_queue_limit = settings.get("tx-queue-limit", DEFAULT_TX_QUEUE_LIMIT);
+	if (m_tx_queue_limit == 0) {
+		std::cerr << "Invalid CAN tx-queue-limit" << std::endl;
+		return;
+	}
+	m_reopen_interval = settings.get("reopen-interval", DEFAULT_REOPEN_INTERVAL);
+	m_max_age = settings.get("max-age", 0) * 1000000LL;
+
+	std::string txMode = settings.get("tx-mode", "raw");
+	std::stringstream().swap(ss);
+	ss << txMode;
+	ss >> std::quoted(txMode);
+	if (txMode == "bcm") {
+		m_use_bcm = true;
+	} else if (txMode != "raw") {
+		std::cerr << "Invalid CAN tx-mode" << std::endl;
+		return;
+	}
+
+	// Signal to frame mapping, from [frame:*] and [signal:*] sections
+	if (!m_map.load(pt)) {
+		std::cerr << "Invalid CAN signal mapping" << std::endl;
+		return;
+	}
+
 	m_config_valid = true;
 }
 
-void MonitorCanHelper::can_open()
+bool MonitorCanHelper::can_open()
 {
 	if (!m_config_valid)
-		return;
+		return false;
 
-	if (m_verbose > 1)
-		std::cout << "MonitorCanHelper::MonitorCanHelper: using port " << m_port << std::endl;
+	LOG_DEBUG(LogComponent::Can, "MonitorCanHelper::MonitorCanHelper: using port " << m_port);
 
-	// Open raw CAN socket
-	m_can_socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-	if (m_can_socket < 0) {
-		return;
+	// Open raw CAN socket, writes never block the event loop
+	int fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+	if (fd < 0) {
+		return false;
 	}
 
-	// Look up port address
+	// Look up port address, a port that is down cannot be written to
 	struct ifreq ifr;
 	strcpy(ifr.ifr_name, m_port.c_str());
-	if (ioctl(m_can_socket, SIOCGIFINDEX, &ifr) < 0) {
-		close(m_can_socket);
-		return;
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0) {
+		close(fd);
+		return false;
+	}
+	m_link_down = !(ifr.ifr_flags & IFF_UP);
+	if (m_link_down) {
+		LOG_DEBUG(LogComponent::Can, "Can Helper - " << m_port << " is down");
+		close(fd);
+		return false;
+	}
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		close(fd);
+		return false;
 	}
 
 	m_can_addr.can_family = AF_CAN;
 	m_can_addr.can_ifindex = ifr.ifr_ifindex;
-	if (bind(m_can_socket, (struct sockaddr*) &m_can_addr, sizeof(m_can_addr)) < 0) {
-		close(m_can_socket);
-		return;
+	if (bind(fd, (struct sockaddr*) &m_can_addr, sizeof(m_can_addr)) < 0) {
+		close(fd);
+		return false;
 	}
 
+	m_can_socket = fd;
+	m_can_stream.assign(fd);
 	m_active = true;
-	if (m_verbose > 1)
-		std::cout << "MonitorCanHelper::MonitorCanHelper: opened " << m_port << std::endl;
+	LOG_DEBUG(LogComponent::Can, "MonitorCanHelper::MonitorCanHelper: opened " << m_port);
+
+	rx_filter();
+
+	if (m_use_bcm)
+		bcm_open(ifr.ifr_ifindex);
+	return true;
+}
+
+void MonitorCanHelper::bcm_open(int ifindex)
+{
+	// Cyclic frames are registered with the broadcast manager, which
+	// then sends them from the kernel without user space wakeups.
+	// On-change frames keep going through the raw socket.
+	m_bcm_socket = socket(PF_CAN, SOCK_DGRAM | SOCK_CLOEXEC, CAN_BCM);
+	if (m_bcm_socket < 0) {
+		LOG_WARNING(LogComponent::Can, "Could not open CAN_BCM socket, timing cyclic frames in user space");
+		m_scheduler.set_cyclic_handler(nullptr);
+		return;
+	}
+
+	struct sockaddr_can addr = {};
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifindex;
+	if (connect(m_bcm_socket, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		LOG_WARNING(LogComponent::Can, "Could not connect CAN_BCM socket, timing cyclic frames in user space");
+		close(m_bcm_socket);
+		m_bcm_socket = -1;
+		m_scheduler.set_cyclic_handler(nullptr);
+		return;
+	}
+
+	m_scheduler.set_cyclic_handler([this](const struct can_frame &frame, unsigned cycle_time,
+					      bool setup, bool announce) {
+		bcm_setup(frame, cycle_time, setup, announce);
+	});
+
+	LOG_DEBUG(LogComponent::Can, "MonitorCanHelper::bcm_open: using broadcast manager for cyclic frames");
+}
+
+void MonitorCanHelper::bcm_setup(const struct can_frame &frame, unsigned cycle_time, bool setup, bool announce)
+{
+	// bcm_msg_head ends in a flexible array of frames, so the message
+	// is assembled in a plain buffer.
+	struct bcm_msg_head head = {};
+	uint8_t msg[sizeof(struct bcm_msg_head) + sizeof(struct can_frame)];
+
+	// The first TX_SETUP starts the cyclic timer, later ones only
+	// replace the payload used for the next cycle.
+	head.opcode = TX_SETUP;
+	head.can_id = frame.can_id;
+	head.nframes = 1;
+	if (setup) {
+		head.flags = SETTIMER | STARTTIMER;
+		head.count = 0;
+		head.ival2.tv_sec = cycle_time / 1000;
+		head.ival2.tv_usec = (cycle_time % 1000) * 1000;
+	}
+	if (announce)
+		head.flags |= TX_ANNOUNCE;
+	memcpy(msg, &head, sizeof(head));
+	memcpy(msg + sizeof(head), &frame, sizeof(frame));
+
+	if (write(m_bcm_socket, &msg, sizeof(msg)) < 0)
+		LOG_ERROR(LogComponent::Can, "CAN_BCM setup of " << std::hex << frame.can_id << std::dec << " failed!");
+	else
+		record_sent(frame.can_id, monotonic_ns());
+}
+
+void MonitorCanHelper::record_sent(canid_t id, int64_t now)
+{
+	// Only the first write after a signal was encoded counts, cyclic
+	// repetitions do not
+	auto signals = m_map.signals_of(id);
+	if (!signals)
+		return;
+	for (VisSignalId signal : *signals) {
+		if (signal < m_dispatched.size() && m_dispatched[signal]) {
+			m_latency.record(signal, LatencyTracker::DispatchToSend, now - m_dispatched[signal]);
+			m_dispatched[signal] = 0;
+		}
+	}
 }
 
 void MonitorCanHelper::can_close()
+{
+	// Closing the BCM socket also removes its cyclic transmissions
+	if (m_bcm_socket >= 0) {
+		close(m_bcm_socket);
+		m_bcm_socket = -1;
+	}
+	if (m_active) {
+		boost::system::error_code ec;
+		m_can_stream.close(ec);
+		m_active = false;
+	}
+	m_backoff_timer.cancel();
+	m_writing = false;
+	m_pending.clear();
+	m_pending_depth.store(0, std::memory_order_relaxed);
+}
+
+void MonitorCanHelper::can_fail(const char *what)
+{
+	LOG_ERROR(LogComponent::Can, "Write to " << m_port << " failed: " << what);
+	m_tx_failed++;
+	can_close();
+	schedule_reopen();
+}
+
+void MonitorCanHelper::schedule_reopen()
+{
+	// Polling is pointless while netlink will tell when the port
+	// comes back up
+	if (m_link_down && m_netlink.is_open())
+		return;
+
+	m_reopen_timer.expires_after(std::chrono::milliseconds(m_reopen_interval));
+	m_reopen_timer.async_wait([this](const boost::system::error_code &error) {
+		if (!error)
+			can_reopen();
+	});
+}
+
+void MonitorCanHelper::can_reopen()
 {
 	if (m_active)
-		close(m_can_socket);
+		return;
+
+	if (!can_open()) {
+		schedule_reopen();
+		return;
+	}
+	m_reopen_timer.cancel();
+	m_reopens++;
+	LOG_NOTICE(LogComponent::Can, "Can Helper - Reopened " << m_port);
+
+	// The frames sent so far, and any BCM setup, went with the old
+	// socket, so the current payloads are sent again.
+	m_scheduler.resend();
+}
+
+void MonitorCanHelper::netlink_open()
+{
+	// Link state changes of any interface, used to reopen the CAN
+	// socket as soon as the port comes back up.  The reopen timer
+	// covers the case where this is unavailable.
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return;
+
+	struct sockaddr_nl addr = {};
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK;
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return;
+	}
+	m_netlink.assign(fd);
+	netlink_wait();
 }
 
-void MonitorCanHelper::set_level(uint8_t level)
+void MonitorCanHelper::netlink_wait()
 {
-	m_level = level;
-	can_update();
+	m_netlink.async_wait(net::posix::stream_descriptor::wait_read,
+			     [this](const boost::system::error_code &error) {
+		if (!error)
+			on_netlink();
+	});
 }
 
-/*
-void MonitorCanHelper::set_pressure(double pressure)
+void MonitorCanHelper::on_netlink()
 {
-	m_pressure = pressure;
-	can_update();
+	char buffer[8192];
+	ssize_t len;
+	while ((len = recv(m_netlink.native_handle(), buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+		for (struct nlmsghdr *nlh = (struct nlmsghdr*) buffer;
+		     NLMSG_OK(nlh, (unsigned) len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK)
+				continue;
+
+			struct ifinfomsg *ifi = (struct ifinfomsg*) NLMSG_DATA(nlh);
+			int attrlen = IFLA_PAYLOAD(nlh);
+			const char *name = nullptr;
+			for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen)) {
+				if (rta->rta_type == IFLA_IFNAME)
+					name = (const char*) RTA_DATA(rta);
+			}
+			if (!name || m_port != name)
+				continue;
+
+			bool up = nlh->nlmsg_type == RTM_NEWLINK && (ifi->ifi_flags & IFF_UP);
+			LOG_DEBUG(LogComponent::Can, "Can Helper - " << m_port << " is " << (up ? "up" : "down"));
+			m_link_down = !up;
+			if (up && !m_active && m_config_valid)
+				can_reopen();
+			else if (!up && m_active)
+				can_fail("interface down");
+			else if (!up)
+				m_reopen_timer.cancel();
+		}
+	}
+	netlink_wait();
+}
+
+void MonitorCanHelper::update(VisSignalId id, const VisValue &value, int64_t received)
+{
+	// Only the latest value per signal is kept, encoding happens when
+	// the mailbox is drained so a stalled bus never holds up the
+	// VIS reader.
+	double phys;
+	if (!value.to_double(phys)) {
+		m_updates_dropped++;
+		return;
+	}
+	if (m_slots) {
+		handoff(id, phys, received);
+		return;
+	}
+	m_mailbox.put(id, phys, received);
+	schedule_drain();
+}
+
+void MonitorCanHelper::bind_signal(const std::string &path, VisSignalId id)
+{
+	// The map is only touched from the CAN side
+	if (!m_thread_config.enabled) {
+		m_map.bind(path, id);
+		return;
+	}
+	net::post(m_ioc, [this, path, id]() {
+		m_map.bind(path, id);
+	});
 }
-*/
 
-void MonitorCanHelper::can_update()
+void MonitorCanHelper::bind_rx_signal(const std::string &path, VisSignalId id)
 {
-	if (!m_active)
+	if (!m_thread_config.enabled) {
+		m_map.bind_rx(path, id);
 		return;
+	}
+	net::post(m_ioc, [this, path, id]() {
+		m_map.bind_rx(path, id);
+	});
+}
 
-	struct can_frame frame;
-	frame.can_id = 0x201;
-	frame.can_dlc = 8;
-	frame.data[0] = 0x00;
-	frame.data[1] = convert_level(m_level);
-	frame.data[2] = 0x00;
-	frame.data[3] = m_level; //convert_pressure(m_pressure);
-	frame.data[4] = 0x0B;
-	frame.data[5] = 0xAD;
-	frame.data[6] = 0xCA;
-	frame.data[7] = 0x78;
+void MonitorCanHelper::schedule_drain()
+{
+	// While frames are waiting for the interface, values keep being
+	// conflated in the mailbox, do_write() resumes draining.
+	if (m_drain_posted || m_writing || m_mailbox.empty())
+		return;
 
-	auto written = sendto(m_can_socket,
-			      &frame,
-			      sizeof(struct can_frame),
-			      0,
-			      (struct sockaddr*) &m_can_addr,
-			      sizeof(m_can_addr));
-	if (written < 0) {
-		std::cerr << "Write to " << m_port << " failed!" << std::endl;
-		close(m_can_socket);
-		m_active = false;
+	m_drain_posted = true;
+	net::post(m_ioc, make_handler(m_handler_memory, [this]() {
+		m_drain_posted = false;
+		drain_mailbox();
+	}));
+}
+
+void MonitorCanHelper::drain_mailbox()
+{
+	if (m_writing)
+		return;
+
+	bool encoded = false;
+	int64_t now = monotonic_ns();
+	m_mailbox.drain([this, &encoded, now](VisSignalId id, double value, int64_t received) {
+		if (m_max_age && now - received > m_max_age) {
+			m_updates_stale++;
+			return;
+		}
+		m_latency.record(id, LatencyTracker::ReceiveToDispatch, now - received);
+		if (!m_map.encode(id, VisValue(value))) {
+			m_updates_dropped++;
+			return;
+		}
+		TRACE(can_encode, id, received, now);
+		encoded = true;
+		if (id >= m_dispatched.size())
+			m_dispatched.resize(id + 1, 0);
+		if (!m_dispatched[id])
+			m_dispatched[id] = now;
+	});
+	if (encoded)
+		m_scheduler.notify();
+}
+
+void MonitorCanHelper::can_transmit(const std::vector<struct can_frame> &frames)
+{
+	if (!m_active || frames.empty())
+		return;
+
+	// Bounded queue, on overflow the oldest frames are the least
+	// useful ones as newer payloads supersede them.
+	for (auto &frame : frames) {
+		if (m_pending.full()) {
+			m_pending.pop_front();
+			m_tx_dropped++;
+		}
+		m_pending.push_back(frame);
+	}
+	m_pending_depth.store(m_pending.size(), std::memory_order_relaxed);
+
+	do_write();
+}
+
+void MonitorCanHelper::do_write()
+{
+	while (m_active && !m_writing && !m_pending.empty()) {
+		// All queued frames go out with a single sendmmsg, the
+		// message vectors are kept around between calls.
+		std::size_t count = m_pending.size();
+		if (m_tx_msgs.size() < count) {
+			m_tx_msgs.resize(count);
+			m_tx_iov.resize(count);
+		}
+		for (std::size_t i = 0; i < count; i++) {
+			m_tx_iov[i].iov_base = &m_pending[i];
+			m_tx_iov[i].iov_len = sizeof(struct can_frame);
+			struct msghdr &hdr = m_tx_msgs[i].msg_hdr;
+			hdr = {};
+			hdr.msg_name = &m_can_addr;
+			hdr.msg_namelen = sizeof(m_can_addr);
+			hdr.msg_iov = &m_tx_iov[i];
+			hdr.msg_iovlen = 1;
+		}
+
+		int64_t start = monotonic_ns();
+		int written = sendmmsg(m_can_socket, m_tx_msgs.data(), count, MSG_DONTWAIT);
+		int64_t end = monotonic_ns();
+		m_tx_latency.record((end - start) / 1000);
+		TRACE(can_write, count, written < 0 ? -errno : written, start, end);
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// Socket buffer full, wait until it drains
+				m_writing = true;
+				m_can_stream.async_wait(net::posix::stream_descriptor::wait_write,
+							make_handler(m_handler_memory,
+								     [this](const boost::system::error_code &error) {
+					// Cancelled when the socket is closed
+					if (error)
+						return;
+					m_writing = false;
+					do_write();
+				}));
+			} else if (errno == ENOBUFS) {
+				// The interface queue is full and the socket does
+				// not signal when it has room, so back off.
+				m_writing = true;
+				m_tx_backoffs++;
+				m_backoff_timer.expires_after(std::chrono::milliseconds(m_backoff));
+				m_backoff_timer.async_wait([this](const boost::system::error_code &error) {
+					// Cancelled when the socket is closed
+					if (error)
+						return;
+					m_writing = false;
+					do_write();
+				});
+				m_backoff = std::min(m_backoff * 2, MAX_TX_BACKOFF);
+			} else {
+				can_fail(strerror(errno));
+			}
+			return;
+		}
+
+		for (int i = 0; i < written; i++) {
+			TRACE(can_sent, m_pending[i].can_id, end);
+			record_sent(m_pending[i].can_id, end);
+		}
+		m_pending.erase(m_pending.begin(), m_pending.begin() + written);
+		m_pending_depth.store(m_pending.size(), std::memory_order_relaxed);
+		m_backoff = MIN_TX_BACKOFF;
+		m_tx_syscalls++;
+		m_tx_frames += written;
+		LOG_DEBUG(LogComponent::Can, "Can Helper - Wrote " << written << " can messages");
+	}
+
+	schedule_drain();
+}
+
+void MonitorCanHelper::rx_filter()
+{
+	// Only frames with a receive mapping wake us up, without any
+	// the socket is transmit only.
+	std::vector<struct can_filter> filters;
+	for (canid_t id : m_map.rx_ids()) {
+		struct can_filter filter;
+		filter.can_id = id;
+		filter.can_mask = (id & CAN_EFF_FLAG) ?
+			(CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK) :
+			(CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK);
+		filters.push_back(filter);
+	}
+	if (setsockopt(m_can_socket, SOL_CAN_RAW, CAN_RAW_FILTER,
+		       filters.empty() ? nullptr : filters.data(),
+		       filters.size() * sizeof(struct can_filter)) < 0) {
+		LOG_ERROR(LogComponent::Can, "Could not set CAN filter on " << m_port);
+		return;
+	}
+
+	if (!filters.empty())
+		rx_wait();
+}
+
+void MonitorCanHelper::rx_wait()
+{
+	m_can_stream.async_wait(net::posix::stream_descriptor::wait_read,
+				make_handler(m_handler_memory,
+					     [this](const boost::system::error_code &error) {
+		// Cancelled when the socket is closed
+		if (error)
+			return;
+		on_rx();
+	}));
+}
+
+void MonitorCanHelper::on_rx()
+{
+	if (m_rx_buffer.empty()) {
+		m_rx_buffer.resize(RX_BATCH);
+		m_rx_msgs.resize(RX_BATCH);
+		m_rx_iov.resize(RX_BATCH);
+	}
+
+	// Drain the socket in batches, the decoded values are published
+	// together once it is empty.
+	int received;
+	do {
+		for (std::size_t i = 0; i < RX_BATCH; i++) {
+			m_rx_iov[i].iov_base = &m_rx_buffer[i];
+			m_rx_iov[i].iov_len = sizeof(struct can_frame);
+			m_rx_msgs[i].msg_hdr = {};
+			m_rx_msgs[i].msg_hdr.msg_iov = &m_rx_iov[i];
+			m_rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		received = recvmmsg(m_can_socket, m_rx_msgs.data(), RX_BATCH, MSG_DONTWAIT, nullptr);
+		if (received < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			m_publisher.flush();
+			can_fail(strerror(errno));
+			return;
+		}
+
+		for (int i = 0; i < received; i++) {
+			m_rx_values.clear();
+			if (!m_map.decode(m_rx_buffer[i], m_rx_values))
+				continue;
+			m_rx_frames++;
+			for (auto &rx : m_rx_values)
+				m_publisher.offer(rx.signal, rx.value, rx.min_interval);
+		}
+	} while (received == RX_BATCH);
+
+	m_publisher.flush();
+	rx_wait();
+}
+
+void MonitorCanHelper::thread_start()
+{
+	m_slots.reset(new HandoffSlot[HANDOFF_SIGNALS]);
+
+	// Without an eventfd wakeups fall back to posting to the thread
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd >= 0) {
+		m_wake.assign(fd);
+		wake_wait();
 	} else {
-		std::cout << "Can Helper - Wrote can message " << std::endl;
+		LOG_ERROR(LogComponent::Can, "Could not create CAN thread eventfd");
 	}
+
+	m_thread = std::thread([this]() {
+		thread_setup();
+
+		// Timers and sockets may all be idle at times
+		auto work = net::make_work_guard(m_thread_ioc);
+		m_thread_ioc.run();
+	});
 }
 
+void MonitorCanHelper::thread_setup()
+{
+	pthread_setname_np(pthread_self(), "can-tx");
+
+	if (m_thread_config.cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(m_thread_config.cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			LOG_WARNING(LogComponent::Can, "Could not pin CAN thread to CPU " << m_thread_config.cpu);
+	}
+
+	if (m_thread_config.priority > 0) {
+		struct sched_param param = {};
+		param.sched_priority = m_thread_config.priority;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+			LOG_WARNING(LogComponent::Can, "Could not set SCHED_FIFO priority for CAN thread");
+	}
 
-uint8_t MonitorCanHelper::convert_level(uint8_t value) {
-	
-	int result = 0;
+	// Avoids page faults on the transmit path, this is process wide
+	if (m_thread_config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		LOG_WARNING(LogComponent::Can, "Could not lock memory: " << strerror(errno));
 
-	if(value < 80){
-		result = value + 50;
-	} else if(value > 79 && value < 101){
-		result = value * 2 + 10;
-	} 
-	return (uint8_t) result;
+	LOG_DEBUG(LogComponent::Can, "Can Helper - CAN thread started");
 }
 
+void MonitorCanHelper::handoff(VisSignalId id, double value, int64_t received)
+{
+	// Runs on the VIS thread.  The slot always holds the latest value,
+	// its ID is only queued if the CAN thread has not yet been told
+	// about an earlier one, so the ring cannot overflow for IDs below
+	// HANDOFF_SIGNALS.
+	if (id >= HANDOFF_SIGNALS) {
+		m_handoff_dropped++;
+		return;
+	}
+	HandoffSlot &slot = m_slots[id];
+	slot.sample.store(HandoffSample{value, received});
+	if (!slot.queued.exchange(true, std::memory_order_acq_rel)) {
+		if (!m_handoff.push(id)) {
+			slot.queued.store(false, std::memory_order_relaxed);
+			m_handoff_dropped++;
+			return;
+		}
+	}
 
-/*
-uint8_t  MonitorCanHelper::convert_pressure(double value) {
-	int result = ((0xF0 - 0x10) / 15) * (((int)value/100) - 15) + 0x10;
-	if (result < 0x10)
-		result = 0x10;
-	if (result > 0xF0)
-		result = 0xF0;
+	// One wakeup per batch, the CAN thread clears the flag before
+	// draining the ring
+	if (m_wake_pending.exchange(true, std::memory_order_acq_rel))
+		return;
+	if (!m_wake.is_open()) {
+		net::post(m_ioc, [this]() { drain_handoff(); });
+		return;
+	}
+	uint64_t one = 1;
+	if (write(m_wake.native_handle(), &one, sizeof(one)) < 0)
+		LOG_ERROR(LogComponent::Can, "Could not wake CAN thread");
+}
+
+void MonitorCanHelper::wake_wait()
+{
+	m_wake.async_wait(net::posix::stream_descriptor::wait_read,
+			  make_handler(m_handler_memory,
+				       [this](const boost::system::error_code &error) {
+		if (!error)
+			on_wake();
+	}));
+}
+
+void MonitorCanHelper::on_wake()
+{
+	uint64_t count;
+	if (read(m_wake.native_handle(), &count, sizeof(count)) < 0 && errno != EAGAIN)
+		LOG_ERROR(LogComponent::Can, "Could not read CAN thread eventfd");
 
-	return (uint8_t) result;
+	drain_handoff();
+	wake_wait();
 }
-*/
 
+void MonitorCanHelper::drain_handoff()
+{
+	m_wake_pending.exchange(false, std::memory_order_acq_rel);
+
+	// Clearing queued before reading the value means a newer value
+	// stored meanwhile queues the ID again rather than getting lost
+	VisSignalId id;
+	while (m_handoff.pop(id)) {
+		HandoffSlot &slot = m_slots[id];
+		slot.queued.exchange(false, std::memory_order_acq_rel);
+		HandoffSample sample = slot.sample.load();
+		m_mailbox.put(id, sample.value, sample.received);
+	}
+	schedule_drain();
+}
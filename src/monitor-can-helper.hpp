@@ -3,33 +3,174 @@
 #ifndef _MONITOR_CAN_HELPER_HPP
 #define _MONITOR_CAN_HELPER_HPP
 
+#include <atomic>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/can.h>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/circular_buffer.hpp>
+#include "can-mailbox.hpp"
+#include "can-signal-map.hpp"
+#include "can-tx-scheduler.hpp"
+#include "can-rx-publisher.hpp"
+#include "spsc-ring.hpp"
+#include "seqlock.hpp"
+#include "latency-histogram.hpp"
+#include "metrics.hpp"
+#include "handler-allocator.hpp"
 
+// Optional dedicated CAN thread, from the [can] section
+struct CanThreadConfig
+{
+	bool enabled;
+	int priority;		// SCHED_FIFO priority, 0 to keep the default
+	int cpu;		// CPU to pin to, -1 for any
+	bool lock_memory;
+};
+
+// Bridges VSS signals and the CAN bus.  By default everything runs on
+// the io_context passed in.  With thread=true in [can] the CAN side gets
+// its own io_context and thread, and values are handed over through
+// per-signal slots and a lock-free ring, so TLS and JSON processing on
+// the VIS thread do not add jitter to frame timing.
 class MonitorCanHelper
 {
 public:
-	MonitorCanHelper();
+	explicit MonitorCanHelper(net::io_context &ioc);
 
 	~MonitorCanHelper();
 
-	void set_level(uint8_t level);
+	// VSS paths mapped to CAN frames
+	std::vector<std::string> paths() const { return m_map.paths(); };
+
+	// Associates a mapped VSS path with its signal ID
+	void bind_signal(const std::string &path, VisSignalId id);
+
+	// Takes a new signal value received at the given monotonic time,
+	// it is encoded and the affected frames scheduled once the bus side
+	// is ready
+	void update(VisSignalId id, const VisValue &value, int64_t received);
+
+	void record_latency(VisSignalId id, LatencyTracker::Stage stage, int64_t nsec) { m_latency.record(id, stage, nsec); };
+
+	LatencyTracker &latency() { return m_latency; };
+
+	// VSS paths decoded from received frames
+	std::vector<std::string> rx_paths() const { return m_map.rx_paths(); };
+
+	// Associates a received VSS path with its signal ID
+	void bind_rx_signal(const std::string &path, VisSignalId id);
+
+	// Where values decoded from received frames are published
+	void set_publish_handler(CanRxPublisher::PublishHandler handler) { m_publish = handler; };
 
-	// void set_pressure(double pressure);
+	// Transmit statistics, frames per syscall is their ratio
+	uint64_t tx_frames() const { return m_tx_frames; };
+	uint64_t tx_syscalls() const { return m_tx_syscalls; };
+	uint64_t tx_dropped() const { return m_tx_dropped; };
+	uint64_t tx_backoffs() const { return m_tx_backoffs; };
+	uint64_t reopens() const { return m_reopens; };
+	uint64_t tx_failed() const { return m_tx_failed; };
+	std::size_t tx_queue_depth() const { return m_pending_depth.load(std::memory_order_relaxed); };
+	const LatencyHistogram &tx_latency() const { return m_tx_latency; };
+	uint64_t rx_frames() const { return m_rx_frames; };
+	uint64_t updates_conflated() const { return m_mailbox.conflated(); };
+	uint64_t frames_sent() const { return m_scheduler.frames_sent(); };
+	uint64_t frames_skipped() const { return m_scheduler.frames_skipped(); };
+	uint64_t rx_published() const { return m_publisher.published(); };
+	uint64_t rx_duplicates() const { return m_publisher.duplicates(); };
+	uint64_t rx_rate_limited() const { return m_publisher.rate_limited(); };
+	uint64_t updates_dropped() const { return m_updates_dropped + m_handoff_dropped; };
+	uint64_t updates_stale() const { return m_updates_stale; };
+	// The same as the VIS side's unless CAN runs on its own thread
+	const HandlerMemory &handler_memory() const { return m_handler_memory; };
 
 private:
+	// Signal slots handed over to the CAN thread
+	static const std::size_t HANDOFF_SIGNALS = 4096;
 
-	uint8_t convert_level(uint8_t value);
-	
-	// uint8_t  convert_pressure(double value);
+	struct HandoffSample
+	{
+		double value;
+		int64_t received;
+	};
+
+	struct HandoffSlot
+	{
+		Seqlock<HandoffSample> sample;
+		std::atomic<bool> queued{false};	// ID is in the ring
+	};
+
+	static CanThreadConfig read_thread_config();
 
 	void read_config();
 
-	void can_open();
+	void thread_start();
+
+	void thread_setup();
+
+	void handoff(VisSignalId id, double value, int64_t received);
+
+	void record_sent(canid_t id, int64_t now);
+
+	void wake_wait();
+
+	void on_wake();
+
+	void drain_handoff();
+
+	bool can_open();
 
 	void can_close();
 
-	void can_update();
+	void can_fail(const char *what);
+
+	void schedule_reopen();
+
+	void can_reopen();
+
+	void netlink_open();
+
+	void netlink_wait();
+
+	void on_netlink();
+
+	void can_transmit(const std::vector<struct can_frame> &frames);
+
+	void do_write();
+
+	void schedule_drain();
+
+	void drain_mailbox();
+
+	void rx_filter();
+
+	void rx_wait();
+
+	void on_rx();
+
+	void bcm_open(int ifindex);
+
+	void bcm_setup(const struct can_frame &frame, unsigned cycle_time, bool setup, bool announce);
+
+	net::io_context &m_vis_ioc;
+	CanThreadConfig m_thread_config;
+	net::io_context m_thread_ioc;
+	// Where all CAN I/O runs, either of the above
+	net::io_context &m_ioc;
+	std::thread m_thread;
+
+	std::unique_ptr<HandoffSlot[]> m_slots;
+	SpscRing<VisSignalId, HANDOFF_SIGNALS> m_handoff;
+	net::posix::stream_descriptor m_wake;
+	HandlerMemory &m_handler_memory;
+	std::atomic<bool> m_wake_pending{false};
+	std::atomic<uint64_t> m_handoff_dropped{0};
 
 	std::string m_port;
 	unsigned m_verbose;
@@ -37,9 +178,60 @@ private:
 	bool m_active;
 	int m_can_socket;
 	struct sockaddr_can m_can_addr;
+	std::vector<struct mmsghdr> m_tx_msgs;
+	std::vector<struct iovec> m_tx_iov;
+	Counter m_tx_frames;
+	Counter m_tx_syscalls;
+	Counter m_tx_dropped;
+	Counter m_tx_backoffs;
+	Counter m_reopens;
+	Counter m_tx_failed;
+	// Mirrors m_pending.size() for readers on other threads
+	std::atomic<std::size_t> m_pending_depth{0};
+	LatencyHistogram m_tx_latency;
+
+	// The raw socket lives on the io_context, frames that cannot be
+	// written right away wait in a bounded queue, allocated once
+	net::posix::stream_descriptor m_can_stream;
+	boost::circular_buffer<struct can_frame> m_pending;
+	std::size_t m_tx_queue_limit;
+	bool m_writing = false;
+	unsigned m_backoff = 1;
+	net::steady_timer m_backoff_timer;
+
+	// Reopening after failures, on link up or periodically.  While
+	// the port is known to be down only link up reopens it.
+	net::posix::stream_descriptor m_netlink;
+	net::steady_timer m_reopen_timer;
+	unsigned m_reopen_interval;
+	bool m_link_down = false;
+
+	// Receive path, only mapped IDs pass the socket filter
+	std::vector<struct can_frame> m_rx_buffer;
+	std::vector<struct mmsghdr> m_rx_msgs;
+	std::vector<struct iovec> m_rx_iov;
+	std::vector<CanSignalMap::RxValue> m_rx_values;
+	CanRxPublisher::PublishHandler m_publish;
+	CanRxPublisher m_publisher;
+	Counter m_rx_frames;
+	// Cyclic frames are timed by the kernel broadcast manager
+	bool m_use_bcm;
+	int m_bcm_socket;
+
+	CanSignalMap m_map;
+	CanMailbox m_mailbox;
+	bool m_drain_posted = false;
+	std::atomic<uint64_t> m_updates_dropped{0};
+	Counter m_updates_stale;
+	// Values older than this are dropped rather than encoded, 0 for
+	// no limit
+	int64_t m_max_age = 0;
 
-	uint8_t m_level;
-	// double m_pressure;
+	// Stage latencies, and when each signal was last encoded into a
+	// frame that has not been written since
+	LatencyTracker m_latency;
+	std::vector<int64_t> m_dispatched;
+	CanTxScheduler m_scheduler;
 };
 
 #endif // _MONITOR_CAN_HELPER_HPP
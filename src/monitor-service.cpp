@@ -1,62 +1,169 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "monitor-service.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <algorithm>
 
 
 MonitorService::MonitorService(const VisConfig &config, net::io_context& ioc, ssl::context& ctx) :
 	VisSession(config, ioc, ctx),
-	m_can_helper()
+	m_can_helper(ioc),
+	m_metrics_exporter(ioc, m_metrics)
 {
+	register_metrics();
+
+	// Signals received from the bus are written back to VSS.  Decoded
+	// values hold no strings, so they can be carried over to the
+	// session's strand.
+	m_can_helper.set_publish_handler([this](VisSignalId signal, const VisValue &value) {
+		net::dispatch(strand(), [this, signal, value]() { set(signal, value); });
+	});
 }
 
 void MonitorService::handle_authorized_response(void)
 {
-	subscribe("Vehicle.TurboCharger.BoostLevel");
-	// subscribe("Vehicle.TurboCharger.BoostPressure");
+	// Configured branches are subscribed to as a whole, the mapped
+	// signals below them then share their subscriptions.
+	std::vector<std::string> paths = m_config.branches();
+	std::size_t branches = paths.size();
+
+	// Everything with a CAN mapping is forwarded to the bus
+	for (auto &path : m_can_helper.paths())
+		paths.push_back(path);
+	std::vector<VisSignalId> signals = subscribe(paths);
+	for (std::size_t i = branches; i < paths.size(); i++) {
+		VisSignalId signal = signals[i];
+		if (signal != INVALID_SIGNAL_ID) {
+			set_handler(signal, &MonitorService::handle_can_signal);
+			m_can_helper.bind_signal(paths[i], signal);
+			register_signal_metrics(signal, paths[i]);
+		}
+	}
+
+	for (auto &path : m_can_helper.rx_paths())
+		m_can_helper.bind_rx_signal(path, m_signals.intern(path));
 }
 
-void MonitorService::handle_get_response(std::string &path, std::string &value, std::string &timestamp)
+void MonitorService::handle_get_response(VisSignalId signal, const VisValue &value, std::string_view timestamp)
 {
-	// Placeholder since no gets are performed ATM
+	// The current value of a signal is handled like a change of it
+	if (signal < m_handlers.size() && m_handlers[signal])
+		(this->*m_handlers[signal])(signal, value, timestamp);
 }
 
-void MonitorService::handle_notification(std::string &path, std::string &value, std::string &timestamp)
+void MonitorService::handle_notification(VisSignalId signal, const VisValue &value, std::string_view timestamp)
 {
-	if (path == "Vehicle.TurboCharger.BoostLevel") {
-		try {
-			int level = std::stoi(value);
-			if (level >= 0 && level < 100)
-				set_level(level);
-		}
-		catch (std::exception ex) {
-			// ignore bad value
-		}
-	} 
-	/*
-	else if (path == "Vehicle.TurboCharger.BoostPressure") {
-		try {
-			double pressure = std::stoi(value);
-			if (pressure >= 0 && pressure < 5000.0)
-				set_pressure(pressure);
-				
-		}
-		catch (std::exception ex) {
-			// ignore bad value
-		}
-	} */
+	TRACE(vis_notification, signal, timestamp.data(), timestamp.size(), receive_time());
+	if (signal < m_handlers.size() && m_handlers[signal])
+		(this->*m_handlers[signal])(signal, value, timestamp);
 	// else ignore
 }
 
-void MonitorService::set_level(uint8_t level)
+void MonitorService::set_handler(VisSignalId signal, NotificationHandler handler)
+{
+	if (signal >= m_handlers.size())
+		m_handlers.resize(signal + 1, nullptr);
+	m_handlers[signal] = handler;
+}
+
+void MonitorService::handle_can_signal(VisSignalId signal, const VisValue &value, std::string_view timestamp)
+{
+	// How long the value took from the server, only meaningful with
+	// synchronized clocks
+	int64_t ts;
+	if (parse_timestamp(timestamp, ts))
+		m_can_helper.record_latency(signal, LatencyTracker::ServerToReceive, receive_wall_time() - ts);
+
+	// Range checks and scaling are part of the mapping
+	m_can_helper.update(signal, value, receive_time());
+}
+
+void MonitorService::register_metrics()
 {
-	m_can_helper.set_level(level);
+	typedef MetricsRegistry::Type Type;
+	MetricsRegistry &m = m_metrics;
+
+	// Metrics are sampled when rendered, on this thread.  Counters
+	// owned by the CAN side are safe to read from here.
+	m.add(Type::Counter, "vis_messages_received_total", "Websocket messages received", "",
+	      [this]() { return messages_received(); });
+	m.add(Type::Counter, "vis_parse_failures_total", "Messages that could not be parsed", "",
+	      [this]() { return parse_failures(); });
+	m.add(Type::Counter, "vis_reconnects_total", "Connections to the VIS server restored", "",
+	      [this]() { return reconnects(); });
+	m.add(Type::Gauge, "vis_write_queue_depth", "Outbound requests waiting to be written", "",
+	      [this]() { return write_queue_depth(); });
+	m.add(Type::Counter, "vis_requests_coalesced_total", "Set requests replaced by a newer one", "",
+	      [this]() { return requests_coalesced(); });
+	m.add(Type::Counter, "vis_requests_dropped_total", "Set requests dropped", "",
+	      [this]() { return requests_dropped(); });
+	m.add(Type::Gauge, "vis_subscriptions", "Signals and branches subscribed to", "",
+	      [this]() { return subscriptions(); });
+	m.add(Type::Gauge, "vis_subscriptions_pending", "Subscriptions not confirmed by the server yet", "",
+	      [this]() { return subscriptions_pending(); });
+	m.add(Type::Counter, "vis_subscription_failures_total", "Subscribe requests refused by the server", "",
+	      [this]() { return subscription_failures(); });
+	m.add(Type::Counter, "vis_notifications_filtered_total", "Notifications dropped by the client side filters", "",
+	      [this]() { return notifications_filtered(); });
+
+	MonitorCanHelper &can = m_can_helper;
+	m.add(Type::Counter, "can_frames_sent_total", "CAN frames written", "",
+	      [&can]() { return can.tx_frames(); });
+	m.add(Type::Counter, "can_write_syscalls_total", "sendmmsg calls writing CAN frames", "",
+	      [&can]() { return can.tx_syscalls(); });
+	m.add(Type::Counter, "can_write_failures_total", "CAN writes failing and closing the socket", "",
+	      [&can]() { return can.tx_failed(); });
+	m.add(Type::Counter, "can_frames_dropped_total", "CAN frames dropped from a full transmit queue", "",
+	      [&can]() { return can.tx_dropped(); });
+	m.add(Type::Counter, "can_write_backoffs_total", "Writes deferred as the interface queue was full", "",
+	      [&can]() { return can.tx_backoffs(); });
+	m.add(Type::Counter, "can_reopens_total", "CAN socket reopened after a failure", "",
+	      [&can]() { return can.reopens(); });
+	m.add(Type::Gauge, "can_tx_queue_depth", "CAN frames waiting for the interface", "",
+	      [&can]() { return can.tx_queue_depth(); });
+	m.add(Type::Counter, "can_frames_skipped_total", "On-change frames not sent as unchanged", "",
+	      [&can]() { return can.frames_skipped(); });
+	m.add(Type::Counter, "can_updates_conflated_total", "Signal updates replaced by a newer value before encoding", "",
+	      [&can]() { return can.updates_conflated(); });
+	m.add(Type::Counter, "can_updates_dropped_total", "Signal updates that could not be encoded", "",
+	      [&can]() { return can.updates_dropped(); });
+	m.add(Type::Counter, "can_updates_stale_total", "Signal updates dropped for exceeding max-age", "",
+	      [&can]() { return can.updates_stale(); });
+	m.add(Type::Counter, "can_rx_frames_total", "Mapped CAN frames received", "",
+	      [&can]() { return can.rx_frames(); });
+	m.add(Type::Counter, "can_rx_published_total", "Received signal values published to VSS", "",
+	      [&can]() { return can.rx_published(); });
+	m.add_histogram("can_write_syscall_seconds", "Duration of CAN sendmmsg calls", "",
+			&can.tx_latency());
+
+	const HandlerMemory &vis_memory = handler_memory();
+	m.add(Type::Counter, "handler_allocation_fallbacks_total", "Handler allocations not served from recycled memory",
+	      MetricsRegistry::label("thread", "vis"), [&vis_memory]() { return vis_memory.fallbacks(); });
+	const HandlerMemory &can_memory = can.handler_memory();
+	if (&can_memory != &vis_memory)
+		m.add(Type::Counter, "handler_allocation_fallbacks_total", "Handler allocations not served from recycled memory",
+		      MetricsRegistry::label("thread", "can"), [&can_memory]() { return can_memory.fallbacks(); });
+
+	m.add(Type::Counter, "log_messages_dropped_total", "Log messages dropped as the log ring was full", "",
+	      []() { return Logger::instance().dropped(); });
 }
 
-/*
-void MonitorService::set_pressure(double pressure)
+void MonitorService::register_signal_metrics(VisSignalId signal, const std::string &path)
 {
-	m_can_helper.set_pressure(pressure);
+	std::string labels = MetricsRegistry::label("path", path);
+	m_metrics.add(MetricsRegistry::Type::Counter, "vis_notifications_total", "Notifications received per signal",
+		      labels, [this, signal]() { return notifications(signal); });
+
+	for (int stage = 0; stage < LatencyTracker::STAGES; stage++) {
+		auto s = static_cast<LatencyTracker::Stage>(stage);
+		const LatencyHistogram *histogram = m_can_helper.latency().histogram(signal, s);
+		if (!histogram)
+			continue;
+		std::string name = "signal_latency_";
+		name += LatencyTracker::stage_name(s);
+		name += "_seconds";
+		m_metrics.add_histogram(name, "Per-signal latency between pipeline stages", labels, histogram);
+	}
 }
-*/
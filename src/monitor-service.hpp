@@ -5,6 +5,9 @@
 
 #include "vis-session.hpp"
 #include "monitor-can-helper.hpp"
+#include "metrics.hpp"
+#include "metrics-exporter.hpp"
+#include <vector>
 
 class MonitorService : public VisSession
 {
@@ -14,17 +17,29 @@ public:
 protected:
 	virtual void handle_authorized_response(void) override;
 
-	virtual void handle_get_response(std::string &path, std::string &value, std::string &timestamp) override;
+	virtual void handle_get_response(VisSignalId signal, const VisValue &value, std::string_view timestamp) override;
 
-	virtual void handle_notification(std::string &path, std::string &value, std::string &timestamp) override;
+	virtual void handle_notification(VisSignalId signal, const VisValue &value, std::string_view timestamp) override;
 
 private:
+	typedef void (MonitorService::*NotificationHandler)(VisSignalId signal, const VisValue &value,
+							    std::string_view timestamp);
+
 	MonitorCanHelper m_can_helper;
 
-	void set_level(uint8_t level);
+	MetricsRegistry m_metrics;
+	MetricsExporter m_metrics_exporter;
+
+	// Notification handlers indexed by signal ID
+	std::vector<NotificationHandler> m_handlers;
+
+	void set_handler(VisSignalId signal, NotificationHandler handler);
+
+	void register_metrics();
 
-	// void set_pressure(double pressure);
+	void register_signal_metrics(VisSignalId signal, const std::string &path);
 
+	void handle_can_signal(VisSignalId signal, const VisValue &value, std::string_view timestamp);
 };
 
 #endif // _MONITOR_SERVICE_HPP
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SEQLOCK_HPP
+#define _SEQLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Single writer, multiple reader slot for a small trivially copyable
+// value.  Readers retry while a write is in progress, the writer never
+// waits.  The value is kept in atomic words so concurrent access is
+// well defined.
+template<typename T>
+class Seqlock
+{
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+	Seqlock()
+	{
+		for (auto &word : m_words)
+			word.store(0, std::memory_order_relaxed);
+	}
+
+	void store(const T &value)
+	{
+		uint64_t words[WORDS] = {};
+		memcpy(words, &value, sizeof(T));
+
+		unsigned seq = m_seq.load(std::memory_order_relaxed);
+		m_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (std::size_t i = 0; i < WORDS; i++)
+			m_words[i].store(words[i], std::memory_order_relaxed);
+		m_seq.store(seq + 2, std::memory_order_release);
+	}
+
+	T load() const
+	{
+		uint64_t words[WORDS];
+		unsigned before, after;
+		do {
+			before = m_seq.load(std::memory_order_acquire);
+			for (std::size_t i = 0; i < WORDS; i++)
+				words[i] = m_words[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = m_seq.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+
+		T value;
+		memcpy(&value, words, sizeof(T));
+		return value;
+	}
+
+private:
+	static const std::size_t WORDS = (sizeof(T) + 7) / 8;
+
+	std::atomic<unsigned> m_seq{0};
+	std::atomic<uint64_t> m_words[WORDS];
+};
+
+#endif // _SEQLOCK_HPP
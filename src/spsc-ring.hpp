@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SPSC_RING_HPP
+#define _SPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer and one consumer
+// thread.  Each side caches the other side's index, so the shared
+// cache lines are only touched when the cached view is exhausted.
+template<typename T, std::size_t Capacity>
+class SpscRing
+{
+	static_assert(Capacity && (Capacity & (Capacity - 1)) == 0,
+		      "Capacity must be a power of two");
+
+public:
+	// Producer side, returns false if the ring is full
+	bool push(const T &item)
+	{
+		std::size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head_cache == Capacity) {
+			m_head_cache = m_head.load(std::memory_order_acquire);
+			if (tail - m_head_cache == Capacity)
+				return false;
+		}
+		m_items[tail & (Capacity - 1)] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, returns false if the ring is empty
+	bool pop(T &item)
+	{
+		std::size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail_cache) {
+			m_tail_cache = m_tail.load(std::memory_order_acquire);
+			if (head == m_tail_cache)
+				return false;
+		}
+		item = m_items[head & (Capacity - 1)];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	// Consumer owned
+	alignas(64) std::atomic<std::size_t> m_head{0};
+	std::size_t m_tail_cache = 0;
+
+	// Producer owned
+	alignas(64) std::atomic<std::size_t> m_tail{0};
+	std::size_t m_head_cache = 0;
+
+	alignas(64) T m_items[Capacity];
+};
+
+#endif // _SPSC_RING_HPP
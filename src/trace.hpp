@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _TRACE_HPP
+#define _TRACE_HPP
+
+// Static tracepoints (USDT) under the agl_monitor provider, e.g.
+// bpftrace -e 'usdt:/usr/sbin/agl-service-monitor:agl_monitor:can_write { ... }'
+// A probe is a single nop until a tracer attaches, arguments should be
+// values already at hand.  Without sys/sdt.h they compile to nothing.
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define TRACE(name, ...) STAP_PROBEV(agl_monitor, name, ##__VA_ARGS__)
+#else
+#define TRACE(name, ...) do { } while (0)
+#endif
+
+#endif // _TRACE_HPP
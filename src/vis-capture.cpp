@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "vis-capture.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "logger.hpp"
+
+static const char CAPTURE_MAGIC[8] = { 'A', 'G', 'L', 'V', 'I', 'S', 'C', 'P' };
+static const uint32_t CAPTURE_VERSION = 1;
+static const std::size_t HEADER_SIZE = sizeof(CAPTURE_MAGIC) + sizeof(uint32_t);
+static const std::size_t RECORD_HEADER_SIZE = 2 * sizeof(int64_t) + sizeof(uint32_t);
+
+VisCaptureWriter::~VisCaptureWriter()
+{
+	close();
+}
+
+bool VisCaptureWriter::open(const std::string &path)
+{
+	close();
+	m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (m_fd < 0) {
+		LOG_ERROR(LogComponent::Vis, "Could not open capture " << path << ": " << strerror(errno));
+		return false;
+	}
+
+	char header[HEADER_SIZE];
+	memcpy(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+	memcpy(header + sizeof(CAPTURE_MAGIC), &CAPTURE_VERSION, sizeof(CAPTURE_VERSION));
+	if (::write(m_fd, header, sizeof(header)) != sizeof(header)) {
+		LOG_ERROR(LogComponent::Vis, "Could not write capture " << path << ": " << strerror(errno));
+		close();
+		return false;
+	}
+	m_records = 0;
+	return true;
+}
+
+void VisCaptureWriter::write(int64_t monotonic, int64_t realtime, const char *data, std::size_t size)
+{
+	if (m_fd < 0 || size > UINT32_MAX)
+		return;
+
+	char header[RECORD_HEADER_SIZE];
+	uint32_t length = size;
+	memcpy(header, &monotonic, sizeof(monotonic));
+	memcpy(header + 8, &realtime, sizeof(realtime));
+	memcpy(header + 16, &length, sizeof(length));
+
+	struct iovec iov[2] = {
+		{ header, sizeof(header) },
+		{ const_cast<char*>(data), size }
+	};
+	ssize_t written;
+	do {
+		written = ::writev(m_fd, iov, 2);
+	} while (written < 0 && errno == EINTR);
+	if (written != static_cast<ssize_t>(sizeof(header) + size)) {
+		// A short write leaves a truncated record, which the reader
+		// takes as the end of the capture.
+		LOG_ERROR(LogComponent::Vis, "Capture write failed, stopping capture: "
+			  << (written < 0 ? strerror(errno) : "short write"));
+		close();
+		return;
+	}
+	m_records++;
+}
+
+void VisCaptureWriter::close()
+{
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+}
+
+VisCaptureReader::~VisCaptureReader()
+{
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+}
+
+bool VisCaptureReader::open(const std::string &path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LOG_ERROR(LogComponent::Vis, "Could not open capture " << path << ": " << strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || static_cast<std::size_t>(st.st_size) < HEADER_SIZE) {
+		LOG_ERROR(LogComponent::Vis, "Capture " << path << " is too short");
+		::close(fd);
+		return false;
+	}
+
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		LOG_ERROR(LogComponent::Vis, "Could not map capture " << path << ": " << strerror(errno));
+		return false;
+	}
+	// Records are read once, front to back
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	uint32_t version;
+	memcpy(&version, static_cast<const char*>(data) + sizeof(CAPTURE_MAGIC), sizeof(version));
+	if (memcmp(data, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || version != CAPTURE_VERSION) {
+		LOG_ERROR(LogComponent::Vis, "Capture " << path << " has an unknown format");
+		munmap(data, st.st_size);
+		return false;
+	}
+
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+	m_data = static_cast<const char*>(data);
+	m_size = st.st_size;
+	m_offset = HEADER_SIZE;
+	return true;
+}
+
+bool VisCaptureReader::next(VisCaptureRecord &record)
+{
+	if (m_size - m_offset < RECORD_HEADER_SIZE)
+		return false;
+
+	const char *header = m_data + m_offset;
+	uint32_t length;
+	memcpy(&record.monotonic, header, sizeof(record.monotonic));
+	memcpy(&record.realtime, header + 8, sizeof(record.realtime));
+	memcpy(&length, header + 16, sizeof(length));
+	if (m_size - m_offset - RECORD_HEADER_SIZE < length)
+		return false;
+
+	record.message = std::string_view(header + RECORD_HEADER_SIZE, length);
+	m_offset += RECORD_HEADER_SIZE + length;
+	return true;
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _VIS_CAPTURE_HPP
+#define _VIS_CAPTURE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Binary log of the raw websocket messages received from the VIS
+// server.  After an 8 byte magic and a 32-bit version, each record is
+//
+//   int64_t  receive time, CLOCK_MONOTONIC ns
+//   int64_t  receive time, CLOCK_REALTIME ns
+//   uint32_t message size
+//   message bytes
+//
+// in host byte order and without padding.
+struct VisCaptureRecord
+{
+	int64_t monotonic;
+	int64_t realtime;
+	std::string_view message;
+};
+
+// Appends messages to a capture file, one writev() per message so
+// nothing is lost if the service dies.  The file is truncated when
+// opened.
+class VisCaptureWriter
+{
+public:
+	VisCaptureWriter() = default;
+	VisCaptureWriter(const VisCaptureWriter&) = delete;
+	VisCaptureWriter &operator=(const VisCaptureWriter&) = delete;
+	~VisCaptureWriter();
+
+	bool open(const std::string &path);
+
+	bool is_open() const { return m_fd >= 0; };
+
+	// Appends a message, on failure the capture is closed
+	void write(int64_t monotonic, int64_t realtime, const char *data, std::size_t size);
+
+	uint64_t records() const { return m_records; };
+
+private:
+	int m_fd = -1;
+	uint64_t m_records = 0;
+
+	void close();
+};
+
+// Iterates over the records of a memory-mapped capture file.  The
+// messages point into the mapping and stay valid while the reader
+// exists.
+class VisCaptureReader
+{
+public:
+	VisCaptureReader() = default;
+	VisCaptureReader(const VisCaptureReader&) = delete;
+	VisCaptureReader &operator=(const VisCaptureReader&) = delete;
+	~VisCaptureReader();
+
+	// Maps the file and checks its header
+	bool open(const std::string &path);
+
+	// Reads the next record, false at the end of the file or at a
+	// truncated record
+	bool next(VisCaptureRecord &record);
+
+private:
+	const char *m_data = nullptr;
+	std::size_t m_size = 0;
+	std::size_t m_offset = 0;
+};
+
+#endif // _VIS_CAPTURE_HPP
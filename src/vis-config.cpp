@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "vis-config.hpp"
+#include "vis-subscriptions.hpp"
 #include <iostream>
 #include <iomanip>
 #include <sstream>
@@ -14,6 +15,9 @@ namespace filesystem = boost::filesystem;
 #define DEFAULT_CLIENT_KEY_FILE  "/etc/kuksa-val/Client.key"
 #define DEFAULT_CLIENT_CERT_FILE "/etc/kuksa-val/Client.pem"
 #define DEFAULT_CA_CERT_FILE     "/etc/kuksa-val/CA.pem"
+#define DEFAULT_WRITE_QUEUE_LIMIT 256
+#define DEFAULT_RECONNECT_MIN_DELAY 500
+#define DEFAULT_RECONNECT_MAX_DELAY 30000
 
 
 VisConfig::VisConfig(const std::string &hostname,
@@ -31,12 +35,20 @@ VisConfig::VisConfig(const std::string &hostname,
 	m_authToken(authToken),
 	m_verifyPeer(verifyPeer),
 	m_verbose(0),
+	m_writeQueueLimit(DEFAULT_WRITE_QUEUE_LIMIT),
+	m_reconnectMinDelay(DEFAULT_RECONNECT_MIN_DELAY),
+	m_reconnectMaxDelay(DEFAULT_RECONNECT_MAX_DELAY),
+	m_serverFilters(false),
 	m_valid(true)
 {
 	// Potentially could do some certificate validation here...
 }
 
 VisConfig::VisConfig(const std::string &appname) :
+	m_writeQueueLimit(DEFAULT_WRITE_QUEUE_LIMIT),
+	m_reconnectMinDelay(DEFAULT_RECONNECT_MIN_DELAY),
+	m_reconnectMaxDelay(DEFAULT_RECONNECT_MAX_DELAY),
+	m_serverFilters(false),
 	m_valid(false)
 {
 	std::string config("/etc/xdg/AGL/");
@@ -61,8 +73,8 @@ VisConfig::VisConfig(const std::string &appname) :
 		std::cerr << "Could not read " << config << std::endl;
 		return;
 	}
-	const property_tree::ptree &settings =
-		pt.get_child("vis-client", property_tree::ptree());
+	const property_tree::ptree empty;
+	const property_tree::ptree &settings = pt.get_child("vis-client", empty);
 
 	m_hostname = settings.get("server", "localhost");
 	std::stringstream ss;
@@ -155,5 +167,49 @@ VisConfig::VisConfig(const std::string &appname) :
 			m_verbose = 2;
 	}
 
+	// Maximum number of outbound requests that may be queued
+	// before further sets are refused.
+	m_writeQueueLimit = settings.get("write-queue-limit", DEFAULT_WRITE_QUEUE_LIMIT);
+	if (m_writeQueueLimit == 0) {
+		std::cerr << "Invalid write queue limit" << std::endl;
+		return;
+	}
+
+	// Reconnect backoff bounds in milliseconds
+	m_reconnectMinDelay = settings.get("reconnect-min-delay", DEFAULT_RECONNECT_MIN_DELAY);
+	m_reconnectMaxDelay = settings.get("reconnect-max-delay", DEFAULT_RECONNECT_MAX_DELAY);
+	if (m_reconnectMinDelay == 0 || m_reconnectMaxDelay < m_reconnectMinDelay) {
+		std::cerr << "Invalid reconnect delay" << std::endl;
+		return;
+	}
+
+	// Optional file to record the received messages to, for replay
+	m_capture = settings.get("capture", "");
+	std::stringstream().swap(ss);
+	ss << m_capture;
+	ss >> std::quoted(m_capture);
+
+	// Branches subscribed to with a single wildcard subscription each,
+	// comma separated, the list may be quoted as a whole
+	std::stringstream list(settings.get("branches", ""));
+	std::string branch;
+	while (std::getline(list, branch, ',')) {
+		branch.erase(0, branch.find_first_not_of(" \t\""));
+		branch.erase(branch.find_last_not_of(" \t\"") + 1);
+		if (branch.empty())
+			continue;
+		if (!VisSubscriptions::is_branch(branch)) {
+			std::cerr << "Invalid branch " << branch << std::endl;
+			return;
+		}
+		m_branches.push_back(branch);
+	}
+
+	// Notification filters per signal, also sent with the
+	// subscriptions if the server supports VISS filters
+	m_serverFilters = settings.get("server-filters", false);
+	if (!load_filters(pt, m_filters))
+		return;
+
 	m_valid = true;
 }
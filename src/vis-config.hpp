@@ -4,6 +4,8 @@
 #define _VIS_CONFIG_HPP
 
 #include <string>
+#include <vector>
+#include "vis-filter.hpp"
 
 class VisConfig
 {
@@ -27,6 +29,13 @@ public:
 	bool verifyPeer() { return m_verifyPeer; };
 	bool valid() { return m_valid; };
 	unsigned verbose() { return m_verbose; };
+	unsigned writeQueueLimit() { return m_writeQueueLimit; };
+	unsigned reconnectMinDelay() { return m_reconnectMinDelay; };
+	unsigned reconnectMaxDelay() { return m_reconnectMaxDelay; };
+	std::string capture() { return m_capture; };
+	std::vector<std::string> branches() { return m_branches; };
+	bool serverFilters() { return m_serverFilters; };
+	const std::vector<VisFilterConfig> &filters() { return m_filters; };
 
 private:
 	std::string m_hostname;
@@ -37,6 +46,13 @@ private:
 	std::string m_authToken;
 	bool m_verifyPeer;
 	unsigned m_verbose;
+	unsigned m_writeQueueLimit;
+	unsigned m_reconnectMinDelay;
+	unsigned m_reconnectMaxDelay;
+	std::string m_capture;
+	std::vector<std::string> m_branches;
+	bool m_serverFilters;
+	std::vector<VisFilterConfig> m_filters;
 	bool m_valid;
 };
 
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "vis-decoder.hpp"
+
+namespace {
+
+// Maximum nesting depth accepted when skipping over values we do not
+// care about, deep enough for anything KUKSA.val sends.
+constexpr unsigned MAX_DEPTH = 32;
+
+// Which object the scanner is currently in, determines which keys
+// are recorded.
+enum class Scope { Top, Data, Datapoint, Other };
+
+class Scanner
+{
+public:
+	Scanner(const char *data, std::size_t size, VisMessage &message) :
+		m_pos(data),
+		m_end(data + size),
+		m_message(message)
+	{
+	}
+
+	bool parse()
+	{
+		skip_ws();
+		if (!parse_object(Scope::Top, 0))
+			return false;
+
+		// Only trailing whitespace is allowed
+		skip_ws();
+		return m_pos == m_end;
+	}
+
+private:
+	const char *m_pos;
+	const char *m_end;
+	VisMessage &m_message;
+
+	void skip_ws()
+	{
+		while (m_pos < m_end &&
+		       (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r'))
+			m_pos++;
+	}
+
+	bool expect(char c)
+	{
+		skip_ws();
+		if (m_pos >= m_end || *m_pos != c)
+			return false;
+		m_pos++;
+		return true;
+	}
+
+	// Parses a string, leaving the escaped raw contents in out
+	bool parse_string(std::string_view &out, bool &escaped)
+	{
+		if (m_pos >= m_end || *m_pos != '"')
+			return false;
+		const char *start = ++m_pos;
+		escaped = false;
+		while (m_pos < m_end) {
+			char c = *m_pos;
+			if (c == '"') {
+				out = std::string_view(start, m_pos - start);
+				m_pos++;
+				return true;
+			} else if (c == '\\') {
+				escaped = true;
+				m_pos += 2;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				return false;
+			} else {
+				m_pos++;
+			}
+		}
+		return false;
+	}
+
+	bool parse_number(std::string_view &out)
+	{
+		const char *start = m_pos;
+		if (m_pos < m_end && *m_pos == '-')
+			m_pos++;
+		bool digits = false;
+		while (m_pos < m_end) {
+			char c = *m_pos;
+			if (c >= '0' && c <= '9') {
+				digits = true;
+			} else if (!(c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')) {
+				break;
+			}
+			m_pos++;
+		}
+		if (!digits)
+			return false;
+		out = std::string_view(start, m_pos - start);
+		return true;
+	}
+
+	bool parse_literal(std::string_view literal, std::string_view &out)
+	{
+		if (static_cast<std::size_t>(m_end - m_pos) < literal.size() ||
+		    std::string_view(m_pos, literal.size()) != literal)
+			return false;
+		out = std::string_view(m_pos, literal.size());
+		m_pos += literal.size();
+		return true;
+	}
+
+	// Parses any scalar value, recording its kind
+	bool parse_scalar(std::string_view &out, VisMessage::ValueKind &kind)
+	{
+		if (m_pos >= m_end)
+			return false;
+
+		switch (*m_pos) {
+		case '"': {
+			bool escaped;
+			if (!parse_string(out, escaped))
+				return false;
+			m_message.escaped |= escaped;
+			kind = VisMessage::ValueKind::String;
+			return true;
+		}
+		case 't':
+			kind = VisMessage::ValueKind::Bool;
+			return parse_literal("true", out);
+		case 'f':
+			kind = VisMessage::ValueKind::Bool;
+			return parse_literal("false", out);
+		case 'n':
+			kind = VisMessage::ValueKind::Null;
+			return parse_literal("null", out);
+		default:
+			kind = VisMessage::ValueKind::Number;
+			return parse_number(out);
+		}
+	}
+
+	bool skip_value(unsigned depth)
+	{
+		skip_ws();
+		if (m_pos >= m_end)
+			return false;
+		if (*m_pos == '{')
+			return parse_object(Scope::Other, depth + 1);
+		if (*m_pos == '[')
+			return skip_array(depth + 1);
+
+		std::string_view unused;
+		VisMessage::ValueKind kind;
+		return parse_scalar(unused, kind);
+	}
+
+	bool skip_array(unsigned depth)
+	{
+		if (depth > MAX_DEPTH || !expect('['))
+			return false;
+		skip_ws();
+		if (m_pos < m_end && *m_pos == ']') {
+			m_pos++;
+			return true;
+		}
+		while (true) {
+			if (!skip_value(depth))
+				return false;
+			skip_ws();
+			if (m_pos >= m_end)
+				return false;
+			if (*m_pos == ']') {
+				m_pos++;
+				return true;
+			}
+			if (*m_pos++ != ',')
+				return false;
+		}
+	}
+
+	// Records a string member, other value types are rejected
+	bool parse_string_member(std::string_view &out)
+	{
+		bool escaped;
+		if (!parse_string(out, escaped))
+			return false;
+		m_message.escaped |= escaped;
+		return true;
+	}
+
+	bool parse_member(Scope scope, std::string_view key, unsigned depth)
+	{
+		skip_ws();
+		if (m_pos >= m_end)
+			return false;
+
+		switch (scope) {
+		case Scope::Top:
+			if (key == "action")
+				return parse_string_member(m_message.action);
+			if (key == "subscriptionId")
+				return parse_string_member(m_message.subscriptionId);
+			if (key == "requestId") {
+				// May be sent back as either a string or a number
+				VisMessage::ValueKind kind;
+				return parse_scalar(m_message.requestId, kind);
+			}
+			if (key == "error") {
+				m_message.hasError = true;
+				break;
+			}
+			if (key == "data" && *m_pos == '{')
+				return parse_object(Scope::Data, depth + 1);
+			break;
+		case Scope::Data:
+			if (key == "path")
+				return parse_string_member(m_message.path);
+			if (key == "dp" && *m_pos == '{')
+				return parse_object(Scope::Datapoint, depth + 1);
+			break;
+		case Scope::Datapoint:
+			if (key == "value" && *m_pos != '{' && *m_pos != '[')
+				return parse_scalar(m_message.value, m_message.valueKind);
+			if (key == "ts")
+				return parse_string_member(m_message.timestamp);
+			break;
+		default:
+			break;
+		}
+		return skip_value(depth);
+	}
+
+	bool parse_object(Scope scope, unsigned depth)
+	{
+		if (depth > MAX_DEPTH || !expect('{'))
+			return false;
+		skip_ws();
+		if (m_pos < m_end && *m_pos == '}') {
+			m_pos++;
+			return true;
+		}
+		while (true) {
+			std::string_view key;
+			bool escaped;
+			skip_ws();
+			if (!parse_string(key, escaped) || !expect(':'))
+				return false;
+			if (!parse_member(escaped ? Scope::Other : scope, key, depth))
+				return false;
+			skip_ws();
+			if (m_pos >= m_end)
+				return false;
+			if (*m_pos == '}') {
+				m_pos++;
+				return true;
+			}
+			if (*m_pos++ != ',')
+				return false;
+		}
+	}
+};
+
+} // namespace
+
+bool VisDecoder::decode(const char *data, std::size_t size, VisMessage &message)
+{
+	message.clear();
+	Scanner scanner(data, size, message);
+	return scanner.parse();
+}
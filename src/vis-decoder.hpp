@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _VIS_DECODER_HPP
+#define _VIS_DECODER_HPP
+
+#include <cstddef>
+#include <string_view>
+
+// Fields of interest extracted from a single VIS message.  All views
+// point into the buffer handed to VisDecoder::decode and are only valid
+// as long as that buffer is.
+struct VisMessage
+{
+	enum class ValueKind { None, String, Number, Bool, Null };
+
+	std::string_view action;
+	std::string_view requestId;
+	std::string_view subscriptionId;
+	std::string_view path;
+	std::string_view value;		// raw token, without quotes for strings
+	ValueKind valueKind = ValueKind::None;
+	std::string_view timestamp;
+	bool hasError = false;
+	bool escaped = false;		// an extracted string contains escapes
+
+	void clear() { *this = VisMessage(); };
+};
+
+// Streaming decoder for the subset of VISS messages handled by VisSession.
+// Scans the raw frame once without building a DOM or allocating, and
+// records views of the fields VisSession needs.  Anything it does not
+// understand makes decode() fail, in which case callers should fall back
+// to a full json parse.
+class VisDecoder
+{
+public:
+	static bool decode(const char *data, std::size_t size, VisMessage &message);
+};
+
+#endif // _VIS_DECODER_HPP
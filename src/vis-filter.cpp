@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "vis-filter.hpp"
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "vis-subscriptions.hpp"
+
+namespace property_tree = boost::property_tree;
+
+static std::string unquote(const std::string &value)
+{
+	if (value.empty() || value[0] != '"')
+		return value;
+
+	std::string result;
+	std::stringstream ss;
+	ss << value;
+	ss >> std::quoted(result);
+	return result;
+}
+
+static bool parse_uint(const std::string &value, unsigned long &out)
+{
+	std::string s = unquote(value);
+	if (s.empty())
+		return false;
+	char *end;
+	out = strtoul(s.c_str(), &end, 0);
+	return *end == '\0';
+}
+
+static bool parse_double(const std::string &value, double &out)
+{
+	std::string s = unquote(value);
+	if (s.empty())
+		return false;
+	char *end;
+	out = strtod(s.c_str(), &end);
+	return *end == '\0' && std::isfinite(out);
+}
+
+bool load_filters(const property_tree::ptree &pt, std::vector<VisFilterConfig> &filters)
+{
+	filters.clear();
+	for (auto &section : pt) {
+		if (section.first.rfind("filter:", 0) != 0)
+			continue;
+		const property_tree::ptree &settings = section.second;
+
+		VisFilterConfig filter;
+		filter.path = unquote(settings.get("path", ""));
+		if (filter.path.empty() || VisSubscriptions::is_branch(filter.path)) {
+			std::cerr << "Invalid path for " << section.first << std::endl;
+			return false;
+		}
+
+		unsigned long interval = 0;
+		if (!parse_uint(settings.get("min-interval", "0"), interval) || interval > UINT32_MAX) {
+			std::cerr << "Invalid min-interval for " << section.first << std::endl;
+			return false;
+		}
+		filter.min_interval = interval;
+
+		if ((settings.count("deadband") && !parse_double(settings.get("deadband", ""), filter.deadband)) ||
+		    filter.deadband < 0 ||
+		    (settings.count("min") && !parse_double(settings.get("min", ""), filter.min)) ||
+		    (settings.count("max") && !parse_double(settings.get("max", ""), filter.max)) ||
+		    filter.min > filter.max) {
+			std::cerr << "Invalid filter for " << section.first << std::endl;
+			return false;
+		}
+		filters.push_back(filter);
+	}
+	return true;
+}
+
+// VISS filter parameters are strings
+static void append_number(std::string &out, double value)
+{
+	char buf[32];
+	auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	out += '"';
+	out.append(buf, result.ptr - buf);
+	out += '"';
+}
+
+// The VISS filter array for config, empty without any filter
+static std::string viss_filter(const VisFilterConfig &config)
+{
+	std::vector<std::string> filters;
+	if (config.min_interval > 0) {
+		std::string filter = "{\"type\":\"timebased\",\"parameter\":{\"period\":";
+		append_number(filter, config.min_interval);
+		filter += "}}";
+		filters.push_back(filter);
+	}
+	if (std::isfinite(config.min) || std::isfinite(config.max)) {
+		std::string filter = "{\"type\":\"range\",\"parameter\":[";
+		if (std::isfinite(config.min)) {
+			filter += "{\"logic-op\":\"gte\",\"boundary\":";
+			append_number(filter, config.min);
+			filter += '}';
+		}
+		if (std::isfinite(config.max)) {
+			if (std::isfinite(config.min))
+				filter += ',';
+			filter += "{\"logic-op\":\"lte\",\"boundary\":";
+			append_number(filter, config.max);
+			filter += '}';
+		}
+		filter += "]}";
+		filters.push_back(filter);
+	}
+	if (config.deadband > 0) {
+		std::string filter = "{\"type\":\"change\",\"parameter\":{\"logic-op\":\"ne\",\"diff\":";
+		append_number(filter, config.deadband);
+		filter += "}}";
+		filters.push_back(filter);
+	}
+
+	std::string viss;
+	for (auto &filter : filters) {
+		viss += viss.empty() ? '[' : ',';
+		viss += filter;
+	}
+	if (!viss.empty())
+		viss += ']';
+	return viss;
+}
+
+void VisFilter::set(VisSignalId signal, const VisFilterConfig &config)
+{
+	if (signal >= m_filters.size())
+		m_filters.resize(signal + 1);
+	Filter &filter = m_filters[signal];
+	filter = Filter();
+	filter.configured = true;
+	filter.min_interval = static_cast<int64_t>(config.min_interval) * 1000000;
+	filter.deadband = config.deadband;
+	filter.min = config.min;
+	filter.max = config.max;
+	filter.viss = viss_filter(config);
+}
+
+const std::string &VisFilter::server_filter(VisSignalId signal) const
+{
+	static const std::string none;
+	if (signal >= m_filters.size() || m_filters[signal].refused)
+		return none;
+	return m_filters[signal].viss;
+}
+
+void VisFilter::server_accepted(VisSignalId signal)
+{
+	if (signal < m_filters.size())
+		m_filters[signal].server = true;
+}
+
+void VisFilter::server_refused(VisSignalId signal)
+{
+	if (signal < m_filters.size()) {
+		m_filters[signal].server = false;
+		m_filters[signal].refused = true;
+	}
+}
+
+void VisFilter::reset_server()
+{
+	for (Filter &filter : m_filters)
+		filter.server = false;
+}
+
+bool VisFilter::check(Filter &filter, const VisValue &value, int64_t now)
+{
+	double number;
+	bool numeric = value.to_double(number);
+	if ((numeric && (number < filter.min || number > filter.max)) ||
+	    (!filter.server && filter.has_last && now - filter.last_time < filter.min_interval) ||
+	    (numeric && filter.has_last_value && std::fabs(number - filter.last_value) < filter.deadband)) {
+		m_filtered++;
+		return false;
+	}
+
+	filter.has_last = true;
+	filter.last_time = now;
+	filter.has_last_value = numeric;
+	filter.last_value = numeric ? number : 0;
+	return true;
+}
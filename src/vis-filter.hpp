@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _VIS_FILTER_HPP
+#define _VIS_FILTER_HPP
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include <boost/property_tree/ptree.hpp>
+#include "vis-signal-table.hpp"
+#include "vis-value.hpp"
+
+// Notification filter of a signal, from a [filter:name] section
+struct VisFilterConfig
+{
+	std::string path;
+	unsigned min_interval = 0;	// milliseconds between values
+	double deadband = 0;		// change from the last value passed
+	double min = -std::numeric_limits<double>::infinity();
+	double max = std::numeric_limits<double>::infinity();
+};
+
+// Reads the [filter:name] sections, false if one is invalid
+bool load_filters(const boost::property_tree::ptree &pt, std::vector<VisFilterConfig> &filters);
+
+// Drops notifications of filtered signals as soon as they are decoded.
+// The same filters can be offered to the server with the subscription
+// as VISS filter options, this then remains as a fallback.
+//
+// Numeric values, including strings holding a number, outside the
+// range or within the deadband of the last value passed are dropped,
+// as are values of any type arriving sooner than min_interval after
+// the last one passed.  The interval is left to the server once it
+// has accepted the filters, as arrival jitter would otherwise drop
+// values it spaced correctly.
+class VisFilter
+{
+public:
+	void set(VisSignalId signal, const VisFilterConfig &config);
+
+	// Whether a notification received at now, monotonic ns, passes
+	bool accept(VisSignalId signal, const VisValue &value, int64_t now)
+	{
+		if (signal >= m_filters.size() || !m_filters[signal].configured)
+			return true;
+		return check(m_filters[signal], value, now);
+	};
+
+	// The VISS "filter" member to subscribe to signal with, empty if
+	// it has no filter or the server refused it
+	const std::string &server_filter(VisSignalId signal) const;
+
+	// Records whether the server applies signal's filter
+	void server_accepted(VisSignalId signal);
+	void server_refused(VisSignalId signal);
+
+	// Forgets what the server applies, e.g. when the connection is lost
+	void reset_server();
+
+	uint64_t filtered() const { return m_filtered; };
+
+private:
+	struct Filter
+	{
+		bool configured = false;
+		bool server = false;		// applied by the server
+		bool refused = false;		// server refused the filter
+		bool has_last = false;
+		bool has_last_value = false;	// last passed was numeric
+		int64_t min_interval = 0;	// ns
+		double deadband = 0;
+		double min = 0;
+		double max = 0;
+		int64_t last_time = 0;
+		double last_value = 0;
+		std::string viss;
+	};
+
+	std::vector<Filter> m_filters;	// indexed by signal ID
+	uint64_t m_filtered = 0;
+
+	bool check(Filter &filter, const VisValue &value, int64_t now);
+};
+
+#endif // _VIS_FILTER_HPP
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "vis-replay.hpp"
+#include <chrono>
+#include <boost/asio/post.hpp>
+#include "latency-histogram.hpp"
+#include "logger.hpp"
+
+// Messages delivered before yielding to other handlers
+static const unsigned REPLAY_BATCH = 64;
+
+VisReplay::VisReplay(net::io_context &ioc, std::shared_ptr<VisSession> session, double speed) :
+	m_ioc(ioc),
+	m_timer(ioc),
+	m_session(session),
+	m_speed(speed)
+{
+}
+
+bool VisReplay::open(const std::string &path)
+{
+	return m_reader.open(path);
+}
+
+void VisReplay::start(DoneHandler done)
+{
+	m_done = done;
+	m_session->start_replay();
+
+	m_replay_start = monotonic_ns();
+	m_have_next = m_reader.next(m_next);
+	if (!m_have_next) {
+		finish();
+		return;
+	}
+	m_capture_start = m_next.monotonic;
+	net::post(m_ioc, [this]() { deliver(); });
+}
+
+void VisReplay::deliver()
+{
+	for (unsigned i = 0; m_have_next && i < REPLAY_BATCH; i++) {
+		if (m_speed > 0) {
+			int64_t due = m_replay_start +
+				static_cast<int64_t>((m_next.monotonic - m_capture_start) / m_speed);
+			int64_t now = monotonic_ns();
+			if (due > now) {
+				m_timer.expires_after(std::chrono::nanoseconds(due - now));
+				m_timer.async_wait([this](const boost::system::error_code &error) {
+					if (!error)
+						deliver();
+				});
+				return;
+			}
+		}
+		m_session->replay(m_next.message, m_next.realtime);
+		m_messages++;
+		m_have_next = m_reader.next(m_next);
+	}
+
+	if (m_have_next)
+		net::post(m_ioc, [this]() { deliver(); });
+	else
+		finish();
+}
+
+void VisReplay::finish()
+{
+	double elapsed = (monotonic_ns() - m_replay_start) / 1e9;
+	LOG_NOTICE(LogComponent::Vis, "Replayed " << m_messages << " messages in " << elapsed << " s ("
+		   << (elapsed > 0 ? m_messages / elapsed : 0) << " messages/s)");
+	if (m_done)
+		m_done();
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _VIS_REPLAY_HPP
+#define _VIS_REPLAY_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "vis-capture.hpp"
+#include "vis-session.hpp"
+
+namespace net = boost::asio;
+
+// Feeds a capture file into a session in place of the websocket.  With
+// a speed of 1 the messages are delivered with their original spacing,
+// other factors scale it and 0 delivers them as fast as the session
+// takes them.  Messages are handed over in small batches so that the
+// CAN side, running on the same io_context, keeps up.
+class VisReplay
+{
+public:
+	typedef std::function<void()> DoneHandler;
+
+	VisReplay(net::io_context &ioc, std::shared_ptr<VisSession> session, double speed);
+
+	bool open(const std::string &path);
+
+	// Starts the replay, done is called after the last message
+	void start(DoneHandler done);
+
+	uint64_t messages() const { return m_messages; };
+
+private:
+	net::io_context &m_ioc;
+	net::steady_timer m_timer;
+	std::shared_ptr<VisSession> m_session;
+	double m_speed;
+	VisCaptureReader m_reader;
+	VisCaptureRecord m_next;
+	bool m_have_next = false;
+	DoneHandler m_done;
+
+	// Capture time of the first record and when it was replayed,
+	// monotonic ns
+	int64_t m_capture_start = 0;
+	int64_t m_replay_start = 0;
+	uint64_t m_messages = 0;
+
+	void deliver();
+
+	void finish();
+};
+
+#endif // _VIS_REPLAY_HPP
@@ -1,24 +1,80 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "vis-session.hpp"
-#include <iostream>
+#include "logger.hpp"
+#include "trace.hpp"
 #include <sstream>
-#include <thread>
+#include <algorithm>
+#include <cassert>
+#include <charconv>
 
 
 // Logging helper
 static void log_error(beast::error_code error, char const* what)
 {
-	std::cerr << what << " error: " << error.message() << std::endl;
+	LOG_ERROR(LogComponent::Vis, what << " error: " << error.message());
+}
+
+// Request IDs are sent as strings but may come back as numbers
+static bool parse_request_id(std::string_view token, unsigned &requestid)
+{
+	const char *end = token.data() + token.size();
+	auto result = std::from_chars(token.data(), end, requestid);
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+static bool parse_request_id(const json &node, unsigned &requestid)
+{
+	if (node.is_string())
+		return parse_request_id(std::string_view(node.get_ref<const std::string&>()), requestid);
+	if (node.is_number_unsigned()) {
+		requestid = node.get<unsigned>();
+		return true;
+	}
+	return false;
+}
+
+// Request ID as sent, for tracing; numeric ones are left out
+static std::string_view request_id_token(const json &message)
+{
+	auto it = message.find("requestId");
+	if (it == message.end() || !it->is_string())
+		return std::string_view();
+	return it->get_ref<const std::string&>();
 }
 
 
 // Resolver and socket require an io_context
 VisSession::VisSession(const VisConfig &config, net::io_context& ioc, ssl::context& ctx) :
+	m_strand(net::make_strand(ioc)),
+	m_ctx(ctx),
+	m_resolver(m_strand),
+	m_reconnect_timer(m_strand),
+	m_subscription_timer(m_strand),
+	m_handler_memory(net::use_service<HandlerMemory>(ioc)),
+	m_state(State::Idle),
+	m_generation(0),
+	m_attempts(0),
+	m_random(std::random_device()()),
+	m_writing(false),
+	m_front_seq(0),
 	m_config(config),
-	m_resolver(net::make_strand(ioc)),
-	m_ws(net::make_strand(ioc), ctx)
+	m_requestid(0)
 {
+	Logger::instance().set_verbosity(LogComponent::Vis, m_config.verbose());
+	m_write_queue.set_capacity(m_config.writeQueueLimit());
+
+	for (auto &filter : m_config.filters())
+		m_filter.set(m_signals.intern(filter.path), filter);
+
+	std::string capture = m_config.capture();
+	if (m_config.valid() && !capture.empty()) {
+		m_capture = std::make_unique<VisCaptureWriter>();
+		if (m_capture->open(capture))
+			LOG_NOTICE(LogComponent::Vis, "Capturing received messages to " << capture);
+		else
+			m_capture.reset();
+	}
 }
 
 // Start the asynchronous operation
@@ -28,72 +84,96 @@ void VisSession::run()
 		return;
 	}
 
+	net::dispatch(m_strand,
+		      beast::bind_front_handler(&VisSession::start_connect,
+						shared_from_this()));
+}
+
+void VisSession::start_connect()
+{
+	// Each connection attempt gets a fresh stream, a websocket over
+	// TLS cannot be reused once it has failed.  The operations aborted
+	// on the old stream still refer to it until they complete, so it
+	// is only destroyed after that; they then see a stale generation
+	// and bail out.
+	if (m_stream_ops > 0) {
+		m_connect_deferred = true;
+		return;
+	}
+	m_generation++;
+	m_ws = std::make_unique<ws_stream>(m_strand, m_ctx);
+	m_state = State::Resolving;
+
 	// Start by resolving hostname
 	m_resolver.async_resolve(m_config.hostname(),
 				 std::to_string(m_config.port()),
 				 beast::bind_front_handler(&VisSession::on_resolve,
-							   shared_from_this()));
+							   shared_from_this(),
+							   m_generation));
+}
+
+// Called first by the completion handler of every operation on m_ws
+void VisSession::on_stream_op()
+{
+	m_stream_ops--;
+	if (m_stream_ops == 0 && m_connect_deferred) {
+		m_connect_deferred = false;
+		start_connect();
+	}
 }
 
-void VisSession::on_resolve(beast::error_code error,
+void VisSession::on_resolve(unsigned generation,
+			    beast::error_code error,
 			    tcp::resolver::results_type results)
 {
+	if (generation != m_generation)
+		return;
+
 	if(error) {
-		log_error(error, "resolve");
+		fail(error, "resolve");
 		return;
 	}
 
 	// Set a timeout on the connect operation
-	beast::get_lowest_layer(m_ws).expires_after(std::chrono::seconds(30));
+	beast::get_lowest_layer(*m_ws).expires_after(std::chrono::seconds(30));
 
 	// Connect to resolved address
-	if (m_config.verbose())
-		std::cout << "Connecting" << std::endl;
-	m_results = results;
-	connect();
+	LOG_INFO(LogComponent::Vis, "Connecting");
+	m_state = State::Connecting;
+	m_stream_ops++;
+	beast::get_lowest_layer(*m_ws).async_connect(results,
+						     beast::bind_front_handler(&VisSession::on_connect,
+									       shared_from_this(),
+									       m_generation));
 }
 
-void VisSession::connect()
-{
-	beast::get_lowest_layer(m_ws).async_connect(m_results,
-						    beast::bind_front_handler(&VisSession::on_connect,
-									      shared_from_this()));
-}
-
-void VisSession::on_connect(beast::error_code error,
+void VisSession::on_connect(unsigned generation,
+			    beast::error_code error,
 			    tcp::resolver::results_type::endpoint_type endpoint)
 {
-	if(error) {
-		// The server can take a while to be ready to accept connections,
-		// so keep retrying until we hit the timeout.
-		if (error == net::error::timed_out) {
-			log_error(error, "connect");
-			return;
-		}
-
-		// Delay 500 ms before retrying
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	on_stream_op();
+	if (generation != m_generation)
+		return;
 
-		if (m_config.verbose())
-			std::cout << "Connecting" << std::endl;
-		
-		connect();
+	if(error) {
+		// The server can take a while to be ready to accept
+		// connections, retry with backoff.
+		fail(error, "connect");
 		return;
 	}
 
-	if (m_config.verbose())
-		std::cout << "Connected" << std::endl;
+	LOG_INFO(LogComponent::Vis, "Connected");
 
 	// Set handshake timeout
-	beast::get_lowest_layer(m_ws).expires_after(std::chrono::seconds(30));
+	beast::get_lowest_layer(*m_ws).expires_after(std::chrono::seconds(30));
 
 	// Set SNI Hostname (many hosts need this to handshake successfully)
-	if(!SSL_set_tlsext_host_name(m_ws.next_layer().native_handle(),
+	if(!SSL_set_tlsext_host_name(m_ws->next_layer().native_handle(),
 				     m_config.hostname().c_str()))
 	{
 		error = beast::error_code(static_cast<int>(::ERR_get_error()),
 					  net::error::get_ssl_category());
-		log_error(error, "connect");
+		fail(error, "connect");
 		return;
 	}
 
@@ -102,160 +182,617 @@ void VisSession::on_connect(beast::error_code error,
 	// See https://tools.ietf.org/html/rfc7230#section-5.4
 	m_hostname = m_config.hostname() + ':' + std::to_string(endpoint.port());
 
-	if (m_config.verbose())
-		std::cout << "Negotiating SSL handshake" << std::endl;
+	LOG_INFO(LogComponent::Vis, "Negotiating SSL handshake");
 
 	// Perform the SSL handshake
-	m_ws.next_layer().async_handshake(ssl::stream_base::client,
-					  beast::bind_front_handler(&VisSession::on_ssl_handshake,
-								    shared_from_this()));
+	m_state = State::Handshaking;
+	m_stream_ops++;
+	m_ws->next_layer().async_handshake(ssl::stream_base::client,
+					   beast::bind_front_handler(&VisSession::on_ssl_handshake,
+								     shared_from_this(),
+								     m_generation));
 }
 
-void VisSession::on_ssl_handshake(beast::error_code error)
+void VisSession::on_ssl_handshake(unsigned generation, beast::error_code error)
 {
+	on_stream_op();
+	if (generation != m_generation)
+		return;
+
 	if(error) {
-		log_error(error, "SSL handshake");
+		fail(error, "SSL handshake");
 		return;
 	}
 
 	// Turn off the timeout on the tcp_stream, because
 	// the websocket stream has its own timeout system.
-	beast::get_lowest_layer(m_ws).expires_never();
-	
-	// NOTE: Explicitly not setting websocket stream timeout here,
-	//       as the client is long-running.
+	beast::get_lowest_layer(*m_ws).expires_never();
 
-	if (m_config.verbose())
-		std::cout << "Negotiating WSS handshake" << std::endl;
+	// The client is long-running, so there is no idle timeout as
+	// such, but keep-alive pings let a dead server be detected and
+	// trigger a reconnect.
+	websocket::stream_base::timeout timeout{
+		std::chrono::seconds(30),	// handshake
+		std::chrono::seconds(30),	// idle
+		true				// keep-alive pings
+	};
+	m_ws->set_option(timeout);
+
+	LOG_INFO(LogComponent::Vis, "Negotiating WSS handshake");
 
 	// Perform handshake
-	m_ws.async_handshake(m_hostname,
-			     "/",
-			     beast::bind_front_handler(&VisSession::on_handshake,
-						       shared_from_this()));
+	m_stream_ops++;
+	m_ws->async_handshake(m_hostname,
+			      "/",
+			      beast::bind_front_handler(&VisSession::on_handshake,
+							shared_from_this(),
+							m_generation));
 }
 
-void VisSession::on_handshake(beast::error_code error)
+void VisSession::on_handshake(unsigned generation, beast::error_code error)
 {
+	on_stream_op();
+	if (generation != m_generation)
+		return;
+
 	if(error) {
-		log_error(error, "WSS handshake");
+		fail(error, "WSS handshake");
 		return;
 	}
 
-	if (m_config.verbose())
-		std::cout << "Authorizing" << std::endl;
+	LOG_INFO(LogComponent::Vis, "Authorizing");
 
-	// Authorize
+	// Authorize, this is the first request on the connection so
+	// everything queued behind it is written once it has gone out.
 	json req;
 	req["requestId"] = std::to_string(m_requestid++);
 	req["action"]= "authorize";
 	req["tokens"] = m_config.authToken();
-	
-	m_ws.async_write(net::buffer(req.dump(4)),
-			 beast::bind_front_handler(&VisSession::on_authorize,
-						   shared_from_this()));
+
+	m_state = State::Authorizing;
+	queue_request(req.dump(), true);
+
+	// Start reading, the read loop runs independently of writes
+	do_read();
 }
 
-void VisSession::on_authorize(beast::error_code error, std::size_t bytes_transferred)
+void VisSession::on_authorized()
 {
-	boost::ignore_unused(bytes_transferred);
+	// Captured authorize responses are not ours
+	if (m_state == State::Replay)
+		return;
 
-	if(error) {
-		log_error(error, "authorize");
+	m_state = State::Ready;
+
+	auto now = std::chrono::steady_clock::now();
+	if (m_attempts > 0 && m_was_ready) {
+		m_reconnects++;
+		m_last_reconnect_time = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_disconnect_time);
+		LOG_INFO(LogComponent::Vis, "Reconnected after " << m_last_reconnect_time.count() << " ms");
+	}
+	m_attempts = 0;
+	m_was_ready = true;
+
+	// Restore the subscriptions of the previous connection before
+	// letting the client add its own.
+	send_subscriptions();
+
+	handle_authorized_response();
+}
+
+void VisSession::fail(beast::error_code error, char const* what)
+{
+	log_error(error, what);
+
+	if (m_state == State::Waiting)
+		return;
+
+	// Reconnect time is measured from the first failure in a row
+	if (m_attempts == 0)
+		m_disconnect_time = std::chrono::steady_clock::now();
+
+	// Abort anything still outstanding on the stream, the handlers
+	// complete with the old generation and are ignored.
+	m_state = State::Waiting;
+	m_generation++;
+	m_resolver.cancel();
+	m_subscription_timer.cancel();
+	m_subscription_timer_armed = false;
+	beast::error_code ignored;
+	beast::get_lowest_layer(*m_ws).socket().close(ignored);
+
+	// Drop the state of the lost connection, subscriptions are
+	// replayed from m_subscriptions once authorized again.
+	while (!m_write_queue.empty()) {
+		recycle_payload(std::move(m_write_queue.front().payload));
+		m_write_queue.pop_front();
+		m_front_seq++;
+	}
+	std::fill(m_queued_sets.begin(), m_queued_sets.end(), UINT64_MAX);
+	m_writing = false;
+	m_subscriptions.reset();
+	m_filter.reset_server();
+	m_signals.clear_subscriptions();
+	m_buffer.consume(m_buffer.size());
+
+	// Jittered exponential backoff: wait between half and all of the
+	// current delay, so a fleet of clients does not reconnect in step.
+	// Never less than a millisecond, or a 1 ms delay would not wait.
+	auto delay = m_config.reconnectMinDelay();
+	for (unsigned i = 0; i < m_attempts && delay < m_config.reconnectMaxDelay(); i++)
+		delay *= 2;
+	delay = std::min(delay, m_config.reconnectMaxDelay());
+	std::uniform_int_distribution<unsigned> jitter(std::max(delay / 2, 1u), delay);
+	std::chrono::milliseconds wait(jitter(m_random));
+	m_attempts++;
+
+	LOG_INFO(LogComponent::Vis, "Reconnecting in " << wait.count() << " ms");
+
+	m_reconnect_timer.expires_after(wait);
+	m_reconnect_timer.async_wait(beast::bind_front_handler(&VisSession::on_reconnect_timer,
+								shared_from_this()));
+}
+
+void VisSession::on_reconnect_timer(beast::error_code error)
+{
+	if (error)
 		return;
+
+	start_connect();
+}
+
+bool VisSession::queue_request(std::string &&payload, bool control, VisSignalId coalesce)
+{
+	// Coalesce with a queued but not yet written request for the same
+	// signal, only the latest value matters.
+	if (coalesce != INVALID_SIGNAL_ID && coalesce < m_queued_sets.size()) {
+		uint64_t seq = m_queued_sets[coalesce];
+		bool in_flight = m_writing && seq == m_front_seq;
+		if (seq != UINT64_MAX && !in_flight) {
+			std::swap(m_write_queue[seq - m_front_seq].payload, payload);
+			recycle_payload(std::move(payload));
+			m_coalesced++;
+			return true;
+		}
+	}
+
+	// Apply backpressure by refusing further data requests when the
+	// queue is full, control requests are always accepted.
+	if (!control && m_write_queue.size() >= m_config.writeQueueLimit()) {
+		m_dropped++;
+		LOG_DEBUG(LogComponent::Vis, "VisSession: write queue full, dropping request");
+		recycle_payload(std::move(payload));
+		return false;
+	}
+
+	// Only control requests go beyond the limit, the queue then
+	// grows instead of overwriting its oldest entry.
+	if (m_write_queue.full())
+		m_write_queue.set_capacity(2 * m_write_queue.capacity());
+	uint64_t seq = m_front_seq + m_write_queue.size();
+	m_write_queue.push_back({std::move(payload), coalesce});
+	if (coalesce != INVALID_SIGNAL_ID) {
+		if (coalesce >= m_queued_sets.size())
+			m_queued_sets.resize(coalesce + 1, UINT64_MAX);
+		m_queued_sets[coalesce] = seq;
 	}
 
-	// Read response
-	m_ws.async_read(m_buffer,
-			beast::bind_front_handler(&VisSession::on_read,
-						  shared_from_this()));
+	do_write();
+	return true;
+}
+
+void VisSession::do_write()
+{
+	if (m_writing || m_write_queue.empty())
+		return;
+
+	// Only one write may be outstanding on the websocket stream,
+	// the rest are pipelined behind it without waiting for responses.
+	m_writing = true;
+	m_stream_ops++;
+	m_ws->async_write(net::buffer(m_write_queue.front().payload),
+			  make_handler(m_handler_memory,
+				       beast::bind_front_handler(&VisSession::on_write,
+								 shared_from_this(),
+								 m_generation)));
 }
 
-// NOTE: Placeholder for now
-void VisSession::on_write(beast::error_code error, std::size_t bytes_transferred)
+void VisSession::on_write(unsigned generation, beast::error_code error, std::size_t bytes_transferred)
 {
 	boost::ignore_unused(bytes_transferred);
 
+	on_stream_op();
+	if (generation != m_generation)
+		return;
+
+	m_writing = false;
 	if(error) {
-		log_error(error, "write");
+		fail(error, "write");
 		return;
 	}
 
-	// Do nothing...
+	OutboundRequest &request = m_write_queue.front();
+	if (request.signal != INVALID_SIGNAL_ID && m_queued_sets[request.signal] == m_front_seq)
+		m_queued_sets[request.signal] = UINT64_MAX;
+	recycle_payload(std::move(request.payload));
+	m_write_queue.pop_front();
+	m_front_seq++;
+
+	do_write();
 }
 
-void VisSession::on_read(beast::error_code error, std::size_t bytes_transferred)
+void VisSession::on_read(unsigned generation, beast::error_code error, std::size_t bytes_transferred)
 {
 	boost::ignore_unused(bytes_transferred);
 
+	on_stream_op();
+	if (generation != m_generation)
+		return;
+
 	if(error) {
-		log_error(error, "read");
+		fail(error, "read");
 		return;
 	}
 
-	// Handle message
-	std::string s = beast::buffers_to_string(m_buffer.data());
-	json response = json::parse(s, nullptr, false);
-	if (!response.is_discarded()) {
-		handle_message(response);
-	} else {
-		std::cerr << "json::parse failed? got " << s << std::endl;
-	}
+	m_receive_time = monotonic_ns();
+	m_receive_wall_time = realtime_ns();
+	m_messages++;
+	TRACE(vis_read, bytes_transferred, m_receive_time);
+
+	// Handle message, the flat_buffer is contiguous so it can be
+	// decoded in place.
+	auto buffer = m_buffer.data();
+	const char *data = static_cast<const char*>(buffer.data());
+	if (m_capture)
+		m_capture->write(m_receive_time, m_receive_wall_time, data, buffer.size());
+	handle_frame(data, buffer.size());
 	m_buffer.consume(m_buffer.size());
 
+	// The message may have failed the connection
+	if (generation != m_generation)
+		return;
+
 	// Read next message
-	m_ws.async_read(m_buffer,
-			beast::bind_front_handler(&VisSession::on_read,
-						  shared_from_this()));
+	do_read();
+}
+
+void VisSession::do_read()
+{
+	// The operations of the read and write loops come from recycled
+	// memory
+	m_stream_ops++;
+	m_ws->async_read(m_buffer,
+			 make_handler(m_handler_memory,
+				      beast::bind_front_handler(&VisSession::on_read,
+								shared_from_this(),
+								m_generation)));
+}
+
+void VisSession::handle_frame(const char *data, std::size_t size)
+{
+	bool decoded = VisDecoder::decode(data, size, m_message);
+	TRACE(vis_parsed, 1, decoded, m_receive_time);
+	if (!(decoded && handle_decoded(m_message))) {
+		// Fall back to a full parse for anything the decoder
+		// does not handle itself.
+		json response = json::parse(data, data + size, nullptr, false);
+		TRACE(vis_parsed, 0, !response.is_discarded(), m_receive_time);
+		if (!response.is_discarded()) {
+			handle_message(response);
+		} else {
+			m_parse_failures++;
+			LOG_ERROR(LogComponent::Vis, "json::parse failed? got " << std::string_view(data, size));
+		}
+	}
+}
+
+void VisSession::start_replay()
+{
+	m_state = State::Replay;
+	handle_authorized_response();
 }
 
-void VisSession::get(const std::string &path)
+void VisSession::replay(std::string_view message, int64_t realtime)
 {
+	// The wall clock time is the captured one so that the latency
+	// from the server's timestamps is reproduced, the monotonic one
+	// is now to measure the local path.
+	m_receive_time = monotonic_ns();
+	m_receive_wall_time = realtime;
+	m_messages++;
+	TRACE(vis_read, message.size(), m_receive_time);
+	handle_frame(message.data(), message.size());
+}
+
+VisSignalId VisSession::get(const std::string &path)
+{
+	assert(m_strand.running_in_this_thread());
+	if (!m_config.valid()) {
+		return INVALID_SIGNAL_ID;
+	}
+
+	// The response carries the path, interning here is enough for
+	// it to be resolved.
+	VisSignalId signal = m_signals.intern(path);
+	if (m_state != State::Ready) {
+		LOG_WARNING(LogComponent::Vis, "VisSession: not connected, dropping get of " << path);
+		return signal;
+	}
+	queue_request(build_request(signal, Action::Get, m_requestid++), true);
+	return signal;
+}
+
+void VisSession::set(const std::string &path, const VisValue &value)
+{
+	assert(m_strand.running_in_this_thread());
 	if (!m_config.valid()) {
 		return;
 	}
 
-	json req;
-	req["requestId"] = std::to_string(m_requestid++);
-	req["action"] = "get";
-	req["path"] = path;
-	req["tokens"] = m_config.authToken();
+	// Values set while disconnected would be stale by the time the
+	// connection is back, so they are dropped.
+	if (m_state != State::Ready) {
+		m_dropped++;
+		return;
+	}
+	set(m_signals.intern(path), value);
+}
+
+void VisSession::set(VisSignalId signal, const VisValue &value)
+{
+	assert(m_strand.running_in_this_thread());
+	if (!m_config.valid() || signal >= m_signals.size()) {
+		return;
+	}
+	if (m_state != State::Ready) {
+		m_dropped++;
+		return;
+	}
+	queue_request(build_request(signal, Action::Set, m_requestid++, &value), false, signal);
+}
 
-	m_ws.write(net::buffer(req.dump(4)));
+VisSignalId VisSession::subscribe(const std::string &path)
+{
+	VisSignalId signal = add_subscription(path);
+	if (signal != INVALID_SIGNAL_ID && m_state == State::Ready)
+		send_subscriptions();
+	return signal;
 }
 
-void VisSession::set(const std::string &path, const std::string &value)
+std::vector<VisSignalId> VisSession::subscribe(const std::vector<std::string> &paths)
 {
-	if (!m_config.valid()) {
+	// Branches are added first, so that whatever the order given the
+	// signals below them do not get subscriptions of their own.
+	std::vector<VisSignalId> signals(paths.size(), INVALID_SIGNAL_ID);
+	for (bool branches : { true, false }) {
+		for (std::size_t i = 0; i < paths.size(); i++) {
+			if (VisSubscriptions::is_branch(paths[i]) == branches)
+				signals[i] = add_subscription(paths[i]);
+		}
+	}
+
+	// All requests are queued at once and written back to back
+	// without waiting for the responses.
+	if (m_state == State::Ready)
+		send_subscriptions();
+	return signals;
+}
+
+void VisSession::unsubscribe(const std::string &path)
+{
+	if (!m_config.valid() && m_state != State::Replay) {
 		return;
 	}
 
-	json req;
-	req["requestId"] = std::to_string(m_requestid++);
-	req["action"] = "set";
-	req["path"] = path;
-	req["value"] = value;
-	req["tokens"] = m_config.authToken();
-	
-	m_ws.write(net::buffer(req.dump(4)));
+	VisSignalId signal = m_signals.find(path);
+	if (!m_subscriptions.contains(signal))
+		return;
+
+	bool branch = m_subscriptions.branch(signal);
+	std::string subscriptionId = m_subscriptions.remove(signal);
+	if (!branch)
+		m_signals.bind_subscription(signal, "");
+	if (m_state != State::Ready)
+		return;
+
+	if (!subscriptionId.empty())
+		send_unsubscribe(subscriptionId);
+	// Signals the branch covered need subscriptions of their own now
+	if (branch)
+		send_subscriptions();
 }
 
-void VisSession::subscribe(const std::string &path)
+VisSignalId VisSession::add_subscription(const std::string &path)
 {
-	if (!m_config.valid()) {
+	if (!m_config.valid() && m_state != State::Replay) {
+		return INVALID_SIGNAL_ID;
+	}
+
+	// Intern the path once here, the subscription ID in the response
+	// is bound to the signal so notifications can be resolved without
+	// looking at the path.  Notifications of a branch subscription
+	// share its ID and are resolved by path.
+	VisSignalId signal = m_signals.intern(path);
+
+	// The subscription is remembered so it can be restored after a
+	// reconnect, if not connected now that is when it will be sent.
+	m_subscriptions.add(signal, m_signals.path(signal));
+	return signal;
+}
+
+void VisSession::send_subscribe(VisSignalId signal)
+{
+	unsigned requestid = m_requestid++;
+	m_subscriptions.requested(signal, requestid);
+
+	queue_request(build_request(signal, Action::Subscribe, requestid), true);
+}
+
+void VisSession::send_subscriptions()
+{
+	std::vector<VisSignalId> signals;
+	m_subscriptions.unsent(signals);
+	for (VisSignalId signal : signals)
+		send_subscribe(signal);
+}
+
+void VisSession::send_unsubscribe(std::string_view subscriptionId)
+{
+	std::string payload = "{\"action\":\"unsubscribe\",\"subscriptionId\":";
+	append_json_string(payload, subscriptionId);
+	payload += ",\"requestId\":\"";
+	payload += std::to_string(m_requestid++);
+	payload += "\"}";
+	queue_request(std::move(payload), true);
+}
+
+void VisSession::arm_subscription_timer()
+{
+	// A cancelled wait leaves its expiry behind, it only counts while
+	// the timer is armed
+	auto next = m_subscriptions.next_retry();
+	if (next == VisSubscriptions::clock::time_point::max() ||
+	    (m_subscription_timer_armed && next == m_subscription_timer.expiry()))
 		return;
+
+	m_subscription_timer_armed = true;
+	m_subscription_timer.expires_at(next);
+	m_subscription_timer.async_wait(beast::bind_front_handler(&VisSession::on_subscription_timer,
+								   shared_from_this(),
+								   m_generation));
+}
+
+void VisSession::on_subscription_timer(unsigned generation, beast::error_code error)
+{
+	if (error || generation != m_generation)
+		return;
+
+	m_subscription_timer_armed = false;
+	m_subscriptions.expire_retries(VisSubscriptions::clock::now());
+	send_subscriptions();
+	arm_subscription_timer();
+}
+
+void VisSession::handle_subscribe_response(const json &message)
+{
+	VisSignalId signal = INVALID_SIGNAL_ID;
+	unsigned requestid;
+	if (message.contains("requestId") &&
+	    parse_request_id(message["requestId"], requestid))
+		signal = m_subscriptions.take_request(requestid);
+
+	std::string_view subscriptionId;
+	if (message.contains("subscriptionId") && message["subscriptionId"].is_string())
+		subscriptionId = message["subscriptionId"].get_ref<const std::string&>();
+
+	// Whether the request carried the signal's filter
+	bool filtered = signal != INVALID_SIGNAL_ID && m_config.serverFilters() &&
+		!m_filter.server_filter(signal).empty();
+
+	if (message.contains("error")) {
+		std::string error = "unknown";
+		if (message["error"].is_object() && message["error"].contains("message"))
+			error = message["error"]["message"];
+		if (signal == INVALID_SIGNAL_ID) {
+			LOG_ERROR(LogComponent::Vis, "VIS subscription failed: " << error);
+			return;
+		}
+		if (filtered) {
+			// Subscribe again right away without it
+			LOG_WARNING(LogComponent::Vis, "VIS server refused the filter for " << m_signals.path(signal)
+				    << ": " << error << ", filtering locally");
+			m_filter.server_refused(signal);
+			send_subscribe(signal);
+			return;
+		}
+		auto delay = m_subscriptions.failed(signal,
+						    std::chrono::milliseconds(m_config.reconnectMinDelay()),
+						    std::chrono::milliseconds(m_config.reconnectMaxDelay()));
+		LOG_ERROR(LogComponent::Vis, "VIS subscription to " << m_signals.path(signal) << " failed: "
+			  << error << ", retrying in " << delay.count() << " ms");
+		arm_subscription_timer();
+	} else if (signal != INVALID_SIGNAL_ID && !subscriptionId.empty()) {
+		m_subscriptions.confirmed(signal, subscriptionId);
+		if (filtered)
+			m_filter.server_accepted(signal);
+		if (!m_subscriptions.branch(signal))
+			m_signals.bind_subscription(signal, subscriptionId);
+	} else if (!subscriptionId.empty() && m_state == State::Ready) {
+		// Unsubscribed while the request was in flight
+		send_unsubscribe(subscriptionId);
 	}
+}
 
-	json req;
-	req["requestId"] = std::to_string(m_requestid++);
-	req["action"] = "subscribe";
-	req["path"] = path;
-	req["tokens"] = m_config.authToken();
-	
-	m_ws.write(net::buffer(req.dump(4)));
+std::string VisSession::build_request(VisSignalId signal, Action action, unsigned requestid, const VisValue *value)
+{
+	static const char *actions[] = { "get", "set", "subscribe" };
+
+	// The serialized request up to the requestId is fixed for a given
+	// action and path, so it is built once and reused.  The connection
+	// is authorized once, so the token is not repeated per request.
+	if (signal >= m_templates.size())
+		m_templates.resize(signal + 1);
+	std::string &prefix = m_templates[signal][static_cast<unsigned>(action)];
+	if (prefix.empty()) {
+		prefix = "{\"action\":\"";
+		prefix += actions[static_cast<unsigned>(action)];
+		prefix += "\",\"path\":";
+		append_json_string(prefix, m_signals.path(signal));
+		prefix += ",\"requestId\":\"";
+	}
+
+	std::string payload;
+	if (!m_free_payloads.empty()) {
+		payload = std::move(m_free_payloads.back());
+		m_free_payloads.pop_back();
+	}
+	payload.assign(prefix);
+
+	char buf[16];
+	auto result = std::to_chars(buf, buf + sizeof(buf), requestid);
+	payload.append(buf, result.ptr - buf);
+	payload += '"';
+	if (value) {
+		payload += ",\"value\":";
+		value->append_json(payload);
+	}
+	if (action == Action::Subscribe && m_config.serverFilters()) {
+		const std::string &filter = m_filter.server_filter(signal);
+		if (!filter.empty()) {
+			payload += ",\"filter\":";
+			payload += filter;
+		}
+	}
+	payload += '}';
+	return payload;
 }
 
-bool VisSession::parseData(const json &message, std::string &path, std::string &value, std::string &timestamp)
+void VisSession::recycle_payload(std::string &&payload)
+{
+	// Keep written request buffers around for reuse, bounded by how
+	// many could be queued at once.
+	if (m_free_payloads.size() < m_config.writeQueueLimit())
+		m_free_payloads.push_back(std::move(payload));
+}
+
+VisSignalId VisSession::resolve_signal(std::string_view subscriptionId, std::string_view path)
+{
+	VisSignalId signal = INVALID_SIGNAL_ID;
+	if (!subscriptionId.empty())
+		signal = m_signals.find_subscription(subscriptionId);
+	if (signal == INVALID_SIGNAL_ID)
+		signal = m_signals.find(path);
+	return signal;
+}
+
+void VisSession::count_notification(VisSignalId signal)
+{
+	if (signal >= m_notification_counts.size())
+		m_notification_counts.resize(signal + 1, 0);
+	m_notification_counts[signal]++;
+}
+
+bool VisSession::parseData(const json &message, VisSignalId &signal, VisValue &value, std::string_view &timestamp)
 {
 	if (message.contains("error")) {
 		std::string error = message["error"];
@@ -263,96 +800,103 @@ bool VisSession::parseData(const json &message, std::string &path, std::string &
 	}
 
 	if (!(message.contains("data") && message["data"].is_object())) {
-		std::cerr << "Malformed message (data missing)" << std::endl;
+		LOG_ERROR(LogComponent::Vis, "Malformed message (data missing)");
+		m_parse_failures++;
 		return false;
 	}
-	auto data = message["data"];
+	const json &data = message["data"];
 	if (!(data.contains("path") && data["path"].is_string())) {
-		std::cerr << "Malformed message (path missing)" << std::endl;
+		LOG_ERROR(LogComponent::Vis, "Malformed message (path missing)");
+		m_parse_failures++;
+		return false;
+	}
+	std::string_view subscriptionId;
+	if (message.contains("subscriptionId") && message["subscriptionId"].is_string())
+		subscriptionId = message["subscriptionId"].get_ref<const std::string&>();
+	signal = resolve_signal(subscriptionId, data["path"].get_ref<const std::string&>());
+	if (signal == INVALID_SIGNAL_ID) {
+		LOG_DEBUG(LogComponent::Vis, "Ignoring data for unknown signal " << data["path"]);
 		return false;
 	}
-	path = data["path"];
-	// Convert '/' to '.' in paths to ensure consistency for clients
-	std::replace(path.begin(), path.end(), '/', '.');
 
 	if (!(data.contains("dp") && data["dp"].is_object())) {
-		std::cerr << "Malformed message (datapoint missing)" << std::endl;
+		LOG_ERROR(LogComponent::Vis, "Malformed message (datapoint missing)");
+		m_parse_failures++;
 		return false;
 	}
-	auto dp = data["dp"];
+	const json &dp = data["dp"];
 	if (!dp.contains("value")) {
-		std::cerr << "Malformed message (value missing)" << std::endl;
+		LOG_ERROR(LogComponent::Vis, "Malformed message (value missing)");
+		m_parse_failures++;
 		return false;
-	} else if (dp["value"].is_string()) {
-		value = dp["value"];
-	} else if (dp["value"].is_number_float()) {
-		double num = dp["value"];
-		value = std::to_string(num);
-	} else if (dp["value"].is_number_unsigned()) {
-		unsigned int num = dp["value"];
-		value = std::to_string(num);
-	} else if (dp["value"].is_number_integer()) {
-		int num = dp["value"];
-		value = std::to_string(num);
-	} else if (dp["value"].is_boolean()) {
-		value = dp["value"] ? "true" : "false";
-	} else {
-		std::cerr << "Malformed message (unsupported value type)" << std::endl;
+	} else if (!value.parse(dp["value"])) {
+		LOG_ERROR(LogComponent::Vis, "Malformed message (unsupported value type)");
+		m_parse_failures++;
 		return false;
 	}
 
 	if (!(dp.contains("ts") && dp["ts"].is_string())) {
-		std::cerr << "Malformed message (timestamp missing)" << std::endl;
+		LOG_ERROR(LogComponent::Vis, "Malformed message (timestamp missing)");
+		m_parse_failures++;
 		return false;
 	}
-	timestamp = dp["ts"];
+	timestamp = dp["ts"].get_ref<const std::string&>();
 
 	return true;
 }
 
 void VisSession::handle_message(const json &message)
 {
-	if (m_config.verbose() > 1)
-		std::cout << "VisSession::handle_message: enter, message = " << to_string(message) << std::endl;
+	LOG_DEBUG(LogComponent::Vis, "VisSession::handle_message: enter, message = " << message);
 
 	if (!message.contains("action")) {
-		std::cerr << "Received unknown message (no action), discarding" << std::endl;
+		LOG_ERROR(LogComponent::Vis, "Received unknown message (no action), discarding");
 		return;
 	}
 	
 	std::string action = message["action"];
+	[[maybe_unused]] std::string_view requestid = request_id_token(message);
+	TRACE(vis_dispatch, action.c_str(), action.size(), requestid.data(), requestid.size(), m_receive_time);
 	if (action == "authorize") {
 		if (message.contains("error")) {
 			std::string error = "unknown";
 			if (message["error"].is_object() && message["error"].contains("message"))
 				error = message["error"]["message"];
-			std::cerr << "VIS authorization failed: " << error << std::endl;
+			LOG_ERROR(LogComponent::Vis, "VIS authorization failed: " << error);
+
+			// Nothing works without authorization, so try again
+			// on a fresh connection after the usual backoff.
+			// Captured responses are not ours.
+			if (m_state == State::Authorizing)
+				fail(net::error::access_denied, "authorize");
 		} else {
-			if (m_config.verbose() > 1)
-				std::cout << "authorized" << std::endl;
+			LOG_DEBUG(LogComponent::Vis, "authorized");
 
-			handle_authorized_response();
+			on_authorized();
 		}
 	} else if (action == "subscribe") {
+		handle_subscribe_response(message);
+	} else if (action == "unsubscribe") {
 		if (message.contains("error")) {
 			std::string error = "unknown";
 			if (message["error"].is_object() && message["error"].contains("message"))
 				error = message["error"]["message"];
-			std::cerr << "VIS subscription failed: " << error << std::endl;
+			LOG_ERROR(LogComponent::Vis, "VIS unsubscribe failed: " << error);
 		}
 	} else if (action == "get") {
 		if (message.contains("error")) {
 			std::string error = "unknown";
 			if (message["error"].is_object() && message["error"].contains("message"))
 				error = message["error"]["message"];
-			std::cerr << "VIS get failed: " << error << std::endl;
+			LOG_ERROR(LogComponent::Vis, "VIS get failed: " << error);
 		} else {
-			std::string path, value, ts;
-			if (parseData(message, path, value, ts)) {
-				if (m_config.verbose() > 1)
-					std::cout << "VisSession::handle_message: got response " << path << " = " << value << std::endl;
+			VisSignalId signal;
+			VisValue value;
+			std::string_view ts;
+			if (parseData(message, signal, value, ts)) {
+				LOG_DEBUG(LogComponent::Vis, "VisSession::handle_message: got response " << m_signals.path(signal) << " = " << value);
 
-				handle_get_response(path, value, ts);
+				handle_get_response(signal, value, ts);
 			}
 		}
 	} else if (action == "set") {
@@ -360,21 +904,77 @@ void VisSession::handle_message(const json &message)
 			std::string error = "unknown";
 			if (message["error"].is_object() && message["error"].contains("message"))
 				error = message["error"]["message"];
-			std::cerr << "VIS set failed: " << error;
+			LOG_ERROR(LogComponent::Vis, "VIS set failed: " << error);
 		}
 	} else if (action == "subscription") {
-		std::string path, value, ts;
-		if (parseData(message, path, value, ts)) {
-			if (m_config.verbose() > 1)
-				std::cout << "VisSession::handle_message: got notification " << path << " = " << value << std::endl;
-
-			handle_notification(path, value, ts);
+		VisSignalId signal;
+		VisValue value;
+		std::string_view ts;
+		if (parseData(message, signal, value, ts)) {
+			count_notification(signal);
+			if (m_filter.accept(signal, value, m_receive_time)) {
+				LOG_DEBUG(LogComponent::Vis, "VisSession::handle_message: got notification " << m_signals.path(signal) << " = " << value);
+
+				handle_notification(signal, value, ts);
+			}
 		}
 	} else {
-		std::cerr << "unhandled VIS response of type: " << action;
+		LOG_ERROR(LogComponent::Vis, "unhandled VIS response of type: " << action);
 	}
 
-	if (m_config.verbose() > 1)
-		std::cout << "VisSession::handle_message: exit" << std::endl;
+	LOG_DEBUG(LogComponent::Vis, "VisSession::handle_message: exit");
 }
 
+
+bool VisSession::handle_decoded(const VisMessage &message)
+{
+	// Only error-free notifications, get and set responses are
+	// handled here, everything else goes through handle_message.
+	if (message.hasError || message.escaped)
+		return false;
+
+	// A set that succeeded needs nothing done, the responses come
+	// at the rate CAN values are published so they are not parsed
+	if (message.action == "set") {
+		TRACE(vis_dispatch, message.action.data(), message.action.size(),
+		      message.requestId.data(), message.requestId.size(), m_receive_time);
+		return true;
+	}
+
+	bool notification = (message.action == "subscription");
+	if (!(notification || message.action == "get"))
+		return false;
+
+	if (message.path.empty() || message.timestamp.empty())
+		return false;
+
+	VisValue value;
+	if (!value.parse(message.value, message.valueKind))
+		return false;
+
+	TRACE(vis_dispatch, message.action.data(), message.action.size(),
+	      message.requestId.data(), message.requestId.size(), m_receive_time);
+
+	VisSignalId signal = resolve_signal(message.subscriptionId, message.path);
+	if (signal == INVALID_SIGNAL_ID) {
+		LOG_DEBUG(LogComponent::Vis, "Ignoring data for unknown signal " << message.path);
+		return true;
+	}
+
+	if (notification) {
+		// Filtered values are dropped before anything else is done
+		// with them
+		count_notification(signal);
+		if (!m_filter.accept(signal, value, m_receive_time))
+			return true;
+
+		LOG_DEBUG(LogComponent::Vis, "VisSession::handle_decoded: got notification " << m_signals.path(signal) << " = " << value);
+
+		handle_notification(signal, value, message.timestamp);
+	} else {
+		LOG_DEBUG(LogComponent::Vis, "VisSession::handle_decoded: got response " << m_signals.path(signal) << " = " << value);
+
+		handle_get_response(signal, value, message.timestamp);
+	}
+	return true;
+}
@@ -4,13 +4,29 @@
 #define _VIS_SESSION_HPP
 
 #include "vis-config.hpp"
+#include "vis-capture.hpp"
+#include "vis-decoder.hpp"
+#include "vis-value.hpp"
+#include "vis-signal-table.hpp"
+#include "vis-subscriptions.hpp"
+#include "vis-filter.hpp"
+#include "latency-histogram.hpp"
+#include "handler-allocator.hpp"
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
 #include <string>
+#include <string_view>
 #include <boost/beast/core.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/websocket/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/circular_buffer.hpp>
 #include <nlohmann/json.hpp>
 
 namespace beast = boost::beast;
@@ -18,17 +34,75 @@ namespace websocket = beast::websocket;
 namespace net = boost::asio;
 namespace ssl = boost::asio::ssl;
 using tcp = boost::asio::ip::tcp;
-using json = nlohmann::json;
 
 
 class VisSession : public std::enable_shared_from_this<VisSession>
 {
-	//net::io_context m_ioc;
+	typedef websocket::stream<beast::ssl_stream<beast::tcp_stream>> ws_stream;
+
+	// Connection state machine, Waiting is the backoff delay between
+	// a failure and the next connection attempt.  Replay feeds
+	// captured messages in place of a connection.
+	enum class State { Idle, Resolving, Connecting, Handshaking, Authorizing, Ready, Waiting, Replay };
+
+	net::strand<net::io_context::executor_type> m_strand;
+	ssl::context &m_ctx;
 	tcp::resolver m_resolver;
-	tcp::resolver::results_type m_results;
+	net::steady_timer m_reconnect_timer;
+	net::steady_timer m_subscription_timer;
+	HandlerMemory &m_handler_memory;
 	std::string m_hostname;
-	websocket::stream<beast::ssl_stream<beast::tcp_stream>> m_ws;
+	std::unique_ptr<ws_stream> m_ws;
+	// Operations outstanding on m_ws, the stream is only replaced
+	// once they have all completed.  A connection attempt made before
+	// that is deferred until then.
+	unsigned m_stream_ops = 0;
+	bool m_connect_deferred = false;
+	State m_state;
+	// Bumped for every connection attempt and failure, handlers of
+	// older generations belong to a dead connection and are ignored.
+	unsigned m_generation;
+	unsigned m_attempts;
+	bool m_was_ready = false;
+	std::minstd_rand m_random;
+	std::chrono::steady_clock::time_point m_disconnect_time;
+	std::chrono::milliseconds m_last_reconnect_time{0};
+	uint64_t m_reconnects = 0;
+	// Subscriptions to (re)establish once authorized
+	VisSubscriptions m_subscriptions;
+	bool m_subscription_timer_armed = false;	// a retry wait is outstanding
+	VisFilter m_filter;
 	beast::flat_buffer m_buffer;
+	VisMessage m_message;
+	std::unique_ptr<VisCaptureWriter> m_capture;
+	// When the message being handled was read, nanoseconds on the
+	// monotonic and wall clocks
+	int64_t m_receive_time = 0;
+	int64_t m_receive_wall_time = 0;
+	uint64_t m_messages = 0;
+	uint64_t m_parse_failures = 0;
+	std::vector<uint64_t> m_notification_counts;	// indexed by signal ID
+	// Outbound request queue, the front entry is the one being
+	// written while m_writing is set.
+	struct OutboundRequest
+	{
+		std::string payload;
+		VisSignalId signal;	// set target for coalescing, if any
+	};
+	boost::circular_buffer<OutboundRequest> m_write_queue;
+	bool m_writing;
+	// Sequence number of the queue front, and per signal the sequence
+	// number of its queued set request (UINT64_MAX if none).
+	uint64_t m_front_seq;
+	std::vector<uint64_t> m_queued_sets;
+	uint64_t m_coalesced = 0;
+	uint64_t m_dropped = 0;
+
+	// Pre-serialized request prefixes per signal and action, and
+	// spare request buffers for reuse.
+	enum class Action { Get, Set, Subscribe };
+	std::vector<std::array<std::string, 3>> m_templates;
+	std::vector<std::string> m_free_payloads;
 
 public:
 	// Resolver and socket require an io_context
@@ -37,41 +111,124 @@ public:
 	// Start the asynchronous operation
 	void run();
 
+	// The strand all session state is accessed on
+	const net::strand<net::io_context::executor_type> &strand() const { return m_strand; };
+
+	// Switches to replaying captured messages instead of connecting,
+	// the client subscribes as if it had been authorized.  Replayed
+	// messages are then handed to replay() one at a time.
+	void start_replay();
+
+	void replay(std::string_view message, int64_t realtime);
+
+	// Number of times the connection was lost and restored, and how
+	// long the most recent outage lasted.
+	uint64_t reconnects() const { return m_reconnects; };
+	std::chrono::milliseconds last_reconnect_time() const { return m_last_reconnect_time; };
+
+	// Message and request statistics
+	uint64_t messages_received() const { return m_messages; };
+	uint64_t parse_failures() const { return m_parse_failures; };
+	uint64_t notifications(VisSignalId signal) const
+	{
+		return signal < m_notification_counts.size() ? m_notification_counts[signal] : 0;
+	};
+	std::size_t write_queue_depth() const { return m_write_queue.size(); };
+	uint64_t requests_coalesced() const { return m_coalesced; };
+	uint64_t requests_dropped() const { return m_dropped; };
+	std::size_t subscriptions() const { return m_subscriptions.size(); };
+	std::size_t subscriptions_pending() const { return m_subscriptions.pending(); };
+	uint64_t subscription_failures() const { return m_subscriptions.failures(); };
+	uint64_t notifications_filtered() const { return m_filter.filtered(); };
+	const HandlerMemory &handler_memory() const { return m_handler_memory; };
+
 protected:
 	VisConfig m_config;
 	std::atomic_uint m_requestid;
+	VisSignalTable m_signals;
+
+	int64_t receive_time() const { return m_receive_time; };
+	int64_t receive_wall_time() const { return m_receive_wall_time; };
+
+	void start_connect();
+
+	void on_stream_op();
+
+	void on_resolve(unsigned generation, beast::error_code error, tcp::resolver::results_type results);
+
+	void on_connect(unsigned generation, beast::error_code error, tcp::resolver::results_type::endpoint_type endpoint);
+
+	void on_ssl_handshake(unsigned generation, beast::error_code error);
+
+	void on_handshake(unsigned generation, beast::error_code error);
+
+	void on_authorized();
+
+	void fail(beast::error_code error, char const* what);
+
+	void on_reconnect_timer(beast::error_code error);
+
+	std::string build_request(VisSignalId signal, Action action, unsigned requestid, const VisValue *value = nullptr);
+
+	void recycle_payload(std::string &&payload);
+
+	bool queue_request(std::string &&payload, bool control, VisSignalId coalesce = INVALID_SIGNAL_ID);
+
+	void do_write();
+
+	void on_write(unsigned generation, beast::error_code error, std::size_t bytes_transferred);
+
+	void do_read();
+
+	void on_read(unsigned generation, beast::error_code error, std::size_t bytes_transferred);
+
+	void handle_frame(const char *data, std::size_t size);
+
+	// Requests are issued on the session's strand
+	VisSignalId get(const std::string &path);
+
+	void set(const std::string &path, const VisValue &value);
+
+	void set(VisSignalId signal, const VisValue &value);
+
+	// Subscribes to a signal or, with a path ending in ".*", a branch
+	VisSignalId subscribe(const std::string &path);
+
+	// Subscribes to all paths, the requests are pipelined.  Returns
+	// the signal IDs in the order of paths.
+	std::vector<VisSignalId> subscribe(const std::vector<std::string> &paths);
 
-	void on_resolve(beast::error_code error, tcp::resolver::results_type results);
+	void unsubscribe(const std::string &path);
 
-	void connect();
+	VisSignalId add_subscription(const std::string &path);
 
-	void on_connect(beast::error_code error, tcp::resolver::results_type::endpoint_type endpoint);
+	void send_subscribe(VisSignalId signal);
 
-	void on_ssl_handshake(beast::error_code error);
+	void send_subscriptions();
 
-	void on_handshake(beast::error_code error);
+	void send_unsubscribe(std::string_view subscriptionId);
 
-	void on_authorize(beast::error_code error, std::size_t bytes_transferred);
+	void arm_subscription_timer();
 
-	void on_write(beast::error_code error, std::size_t bytes_transferred);
+	void on_subscription_timer(unsigned generation, beast::error_code error);
 
-	void on_read(beast::error_code error, std::size_t bytes_transferred);
+	void handle_subscribe_response(const json &message);
 
-	void get(const std::string &path);
+	VisSignalId resolve_signal(std::string_view subscriptionId, std::string_view path);
 
-	void set(const std::string &path, const std::string &value);
+	void count_notification(VisSignalId signal);
 
-	void subscribe(const std::string &path);
+	bool handle_decoded(const VisMessage &message);
 
 	void handle_message(const json &message);
 
-	bool parseData(const json &message, std::string &path, std::string &value, std::string &timestamp);
+	bool parseData(const json &message, VisSignalId &signal, VisValue &value, std::string_view &timestamp);
 
 	virtual void handle_authorized_response(void) = 0;
 
-	virtual void handle_get_response(std::string &path, std::string &value, std::string &timestamp) = 0;
+	virtual void handle_get_response(VisSignalId signal, const VisValue &value, std::string_view timestamp) = 0;
 
-	virtual void handle_notification(std::string &path, std::string &value, std::string &timestamp) = 0;
+	virtual void handle_notification(VisSignalId signal, const VisValue &value, std::string_view timestamp) = 0;
 
 };
 
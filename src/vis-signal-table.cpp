@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "vis-signal-table.hpp"
+#include <algorithm>
+
+static inline char normalize(char c)
+{
+	return c == '/' ? '.' : c;
+}
+
+std::size_t VisSignalTable::PathHash::operator()(std::string_view path) const
+{
+	// FNV-1a
+	std::size_t hash = 14695981039346656037ULL;
+	for (char c : path) {
+		hash ^= static_cast<unsigned char>(normalize(c));
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool VisSignalTable::PathEqual::operator()(std::string_view a, std::string_view b) const
+{
+	if (a.size() != b.size())
+		return false;
+	for (std::size_t i = 0; i < a.size(); i++) {
+		if (normalize(a[i]) != normalize(b[i]))
+			return false;
+	}
+	return true;
+}
+
+VisSignalId VisSignalTable::intern(std::string_view path)
+{
+	VisSignalId id = find(path);
+	if (id != INVALID_SIGNAL_ID)
+		return id;
+
+	id = static_cast<VisSignalId>(m_signals.size());
+	Signal &signal = m_signals.emplace_back();
+	signal.path = path;
+	std::replace(signal.path.begin(), signal.path.end(), '/', '.');
+	m_paths.emplace(signal.path, id);
+	return id;
+}
+
+VisSignalId VisSignalTable::find(std::string_view path) const
+{
+	auto it = m_paths.find(path);
+	return it != m_paths.end() ? it->second : INVALID_SIGNAL_ID;
+}
+
+void VisSignalTable::bind_subscription(VisSignalId id, std::string_view subscriptionId)
+{
+	Signal &signal = m_signals[id];
+	if (!signal.subscriptionId.empty())
+		m_subscriptions.erase(signal.subscriptionId);
+
+	signal.subscriptionId = subscriptionId;
+	if (!signal.subscriptionId.empty())
+		m_subscriptions[signal.subscriptionId] = id;
+}
+
+VisSignalId VisSignalTable::find_subscription(std::string_view subscriptionId) const
+{
+	auto it = m_subscriptions.find(subscriptionId);
+	return it != m_subscriptions.end() ? it->second : INVALID_SIGNAL_ID;
+}
+
+void VisSignalTable::clear_subscriptions()
+{
+	m_subscriptions.clear();
+	for (auto &signal : m_signals)
+		signal.subscriptionId.clear();
+}
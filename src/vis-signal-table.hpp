@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _VIS_SIGNAL_TABLE_HPP
+#define _VIS_SIGNAL_TABLE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Compact identifier for a VSS signal, indexes into per-signal tables
+typedef uint32_t VisSignalId;
+constexpr VisSignalId INVALID_SIGNAL_ID = UINT32_MAX;
+
+// Interns VSS paths into dense signal IDs and maps the server's
+// subscription IDs back to them, so notifications can be dispatched
+// without comparing path strings.  Lookups take views and do not
+// allocate.
+class VisSignalTable
+{
+public:
+	// Returns the ID for path, allocating one if required.  Paths
+	// are stored in '.' separated form.
+	VisSignalId intern(std::string_view path);
+
+	// Returns the ID for path, which may use either '/' or '.' as
+	// separator, or INVALID_SIGNAL_ID if it is unknown.
+	VisSignalId find(std::string_view path) const;
+
+	const std::string &path(VisSignalId id) const { return m_signals[id].path; };
+
+	std::size_t size() const { return m_signals.size(); };
+
+	// Associates a server subscription ID with a signal, replacing
+	// any previous one for it.
+	void bind_subscription(VisSignalId id, std::string_view subscriptionId);
+
+	VisSignalId find_subscription(std::string_view subscriptionId) const;
+
+	// Forgets all subscription IDs, e.g. when the connection is lost
+	void clear_subscriptions();
+
+private:
+	// Hashes and compares paths treating '/' and '.' as equal
+	struct PathHash
+	{
+		std::size_t operator()(std::string_view path) const;
+	};
+	struct PathEqual
+	{
+		bool operator()(std::string_view a, std::string_view b) const;
+	};
+
+	struct Signal
+	{
+		std::string path;
+		std::string subscriptionId;
+	};
+
+	// Keys of the maps below are views into these entries, a deque
+	// keeps them at stable addresses as signals are added.
+	std::deque<Signal> m_signals;
+	std::unordered_map<std::string_view, VisSignalId, PathHash, PathEqual> m_paths;
+	std::unordered_map<std::string_view, VisSignalId> m_subscriptions;
+};
+
+#endif // _VIS_SIGNAL_TABLE_HPP
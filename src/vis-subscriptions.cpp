@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "vis-subscriptions.hpp"
+#include <algorithm>
+
+bool VisSubscriptions::is_branch(std::string_view path)
+{
+	return path.size() > 2 && path.substr(path.size() - 2) == ".*";
+}
+
+bool VisSubscriptions::add(VisSignalId signal, std::string_view path)
+{
+	if (signal >= m_entries.size())
+		m_entries.resize(signal + 1);
+	Entry &entry = m_entries[signal];
+	if (entry.wanted)
+		return false;
+
+	entry = Entry();
+	entry.wanted = true;
+	entry.branch = is_branch(path);
+	entry.path = path;
+	m_order.push_back(signal);
+	if (entry.branch)
+		m_branches.emplace_back(path.substr(0, path.size() - 1));
+	return true;
+}
+
+std::string VisSubscriptions::remove(VisSignalId signal)
+{
+	if (!contains(signal))
+		return std::string();
+
+	// A request still in flight stays in m_requests, its response is
+	// then recognized as no longer wanted.
+	Entry &entry = m_entries[signal];
+	std::string subscriptionId;
+	if (entry.state == State::Active)
+		subscriptionId = std::move(entry.subscriptionId);
+	if (entry.branch) {
+		std::string_view prefix(entry.path.data(), entry.path.size() - 1);
+		m_branches.erase(std::find(m_branches.begin(), m_branches.end(), prefix));
+	}
+	m_order.erase(std::find(m_order.begin(), m_order.end(), signal));
+	entry = Entry();
+	return subscriptionId;
+}
+
+bool VisSubscriptions::covered(VisSignalId signal) const
+{
+	if (!contains(signal) || m_entries[signal].branch)
+		return false;
+	const std::string &path = m_entries[signal].path;
+	for (const std::string &prefix : m_branches) {
+		if (path.compare(0, prefix.size(), prefix) == 0)
+			return true;
+	}
+	return false;
+}
+
+void VisSubscriptions::unsent(std::vector<VisSignalId> &signals) const
+{
+	for (VisSignalId signal : m_order) {
+		if (m_entries[signal].state == State::Unsent && !covered(signal))
+			signals.push_back(signal);
+	}
+}
+
+void VisSubscriptions::requested(VisSignalId signal, unsigned requestid)
+{
+	Entry &entry = m_entries[signal];
+	entry.state = State::Requested;
+	entry.requestid = requestid;
+	m_requests[requestid] = signal;
+}
+
+VisSignalId VisSubscriptions::take_request(unsigned requestid)
+{
+	auto it = m_requests.find(requestid);
+	if (it == m_requests.end())
+		return INVALID_SIGNAL_ID;
+	VisSignalId signal = it->second;
+	m_requests.erase(it);
+
+	// Removed, and possibly added again, since the request was sent
+	if (!contains(signal) || m_entries[signal].state != State::Requested ||
+	    m_entries[signal].requestid != requestid)
+		return INVALID_SIGNAL_ID;
+	return signal;
+}
+
+void VisSubscriptions::confirmed(VisSignalId signal, std::string_view subscriptionId)
+{
+	Entry &entry = m_entries[signal];
+	entry.state = State::Active;
+	entry.attempts = 0;
+	entry.subscriptionId = subscriptionId;
+}
+
+std::chrono::milliseconds VisSubscriptions::failed(VisSignalId signal, std::chrono::milliseconds min_delay,
+						   std::chrono::milliseconds max_delay)
+{
+	m_failures++;
+	Entry &entry = m_entries[signal];
+	auto delay = min_delay;
+	for (unsigned i = 0; i < entry.attempts && delay < max_delay; i++)
+		delay *= 2;
+	delay = std::min(delay, max_delay);
+	entry.attempts++;
+	entry.state = State::Retry;
+	entry.retry = clock::now() + delay;
+	return delay;
+}
+
+void VisSubscriptions::expire_retries(clock::time_point now)
+{
+	for (VisSignalId signal : m_order) {
+		Entry &entry = m_entries[signal];
+		if (entry.state == State::Retry && entry.retry <= now)
+			entry.state = State::Unsent;
+	}
+}
+
+VisSubscriptions::clock::time_point VisSubscriptions::next_retry() const
+{
+	clock::time_point next = clock::time_point::max();
+	for (VisSignalId signal : m_order) {
+		const Entry &entry = m_entries[signal];
+		if (entry.state == State::Retry)
+			next = std::min(next, entry.retry);
+	}
+	return next;
+}
+
+void VisSubscriptions::reset()
+{
+	for (VisSignalId signal : m_order) {
+		Entry &entry = m_entries[signal];
+		entry.state = State::Unsent;
+		entry.attempts = 0;
+		entry.subscriptionId.clear();
+	}
+	m_requests.clear();
+}
+
+std::size_t VisSubscriptions::pending() const
+{
+	return std::count_if(m_order.begin(), m_order.end(), [this](VisSignalId signal) {
+		return m_entries[signal].state != State::Active && !covered(signal);
+	});
+}
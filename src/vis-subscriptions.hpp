@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _VIS_SUBSCRIPTIONS_HPP
+#define _VIS_SUBSCRIPTIONS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "vis-signal-table.hpp"
+
+// Bookkeeping for the subscriptions of a session: the signals and
+// branches wanted, the requests awaiting a response, the server's
+// subscription IDs and failed subscriptions waiting to be retried.
+// Sending the requests is up to the session.
+//
+// A branch is a path ending in ".*".  Signals below a wanted branch
+// are covered by its subscription and not subscribed to on their own.
+class VisSubscriptions
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	static bool is_branch(std::string_view path);
+
+	// Adds a wanted subscription, false if it already is.  The path
+	// must be the signal's, in '.' separated form.
+	bool add(VisSignalId signal, std::string_view path);
+
+	// Forgets a subscription, returns the server's subscription ID
+	// if it was active so it can be cancelled
+	std::string remove(VisSignalId signal);
+
+	bool contains(VisSignalId signal) const { return signal < m_entries.size() && m_entries[signal].wanted; };
+
+	bool branch(VisSignalId signal) const { return contains(signal) && m_entries[signal].branch; };
+
+	// Whether signal is below a wanted branch
+	bool covered(VisSignalId signal) const;
+
+	// Collects the wanted subscriptions that are neither active, in
+	// flight, waiting for a retry nor covered, in the order added
+	void unsent(std::vector<VisSignalId> &signals) const;
+
+	// Records the request sent for signal
+	void requested(VisSignalId signal, unsigned requestid);
+
+	// Returns the signal the subscribe request with requestid was sent
+	// for, or INVALID_SIGNAL_ID if it is no longer wanted
+	VisSignalId take_request(unsigned requestid);
+
+	void confirmed(VisSignalId signal, std::string_view subscriptionId);
+
+	// Schedules another attempt after a failure, the delay doubles
+	// with every failure in a row from min_delay up to max_delay
+	std::chrono::milliseconds failed(VisSignalId signal, std::chrono::milliseconds min_delay,
+					 std::chrono::milliseconds max_delay);
+
+	// Makes the retries due by now unsent again
+	void expire_retries(clock::time_point now);
+
+	// When the next retry is due, clock::time_point::max() if none is
+	clock::time_point next_retry() const;
+
+	// Forgets the state of a lost connection, everything wanted is
+	// unsent again
+	void reset();
+
+	std::size_t size() const { return m_order.size(); };
+	// Subscriptions not confirmed by the server, other than covered ones
+	std::size_t pending() const;
+	uint64_t failures() const { return m_failures; };
+
+private:
+	enum class State { Unsent, Requested, Active, Retry };
+
+	struct Entry
+	{
+		bool wanted = false;
+		bool branch = false;
+		State state = State::Unsent;
+		unsigned requestid = 0;
+		unsigned attempts = 0;		// failures in a row
+		clock::time_point retry;
+		std::string path;
+		std::string subscriptionId;
+	};
+
+	std::vector<Entry> m_entries;			// indexed by signal ID
+	std::vector<VisSignalId> m_order;
+	// Prefixes of the wanted branches, including the final '.'
+	std::vector<std::string> m_branches;
+	// requestId -> signal for subscriptions awaiting a response
+	std::unordered_map<unsigned, VisSignalId> m_requests;
+	uint64_t m_failures = 0;
+};
+
+#endif // _VIS_SUBSCRIPTIONS_HPP
@@ -0,0 +1,335 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "vis-value.hpp"
+#include <charconv>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+bool is_float_token(std::string_view token)
+{
+	return token.find_first_of(".eE") != std::string_view::npos;
+}
+
+template<typename T>
+bool parse_integer(std::string_view token, T &out)
+{
+	const char *end = token.data() + token.size();
+	auto result = std::from_chars(token.data(), end, out);
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parse_double(std::string_view token, double &out)
+{
+	const char *end = token.data() + token.size();
+	auto result = std::from_chars(token.data(), end, out);
+	return result.ec == std::errc() && result.ptr == end && std::isfinite(out);
+}
+
+// Parses a numeric token into the narrowest matching representation
+bool parse_number(std::string_view token, VisValue &value)
+{
+	if (is_float_token(token)) {
+		double num;
+		if (!parse_double(token, num))
+			return false;
+		value = VisValue(num);
+	} else if (!token.empty() && token[0] == '-') {
+		int64_t num;
+		if (!parse_integer(token, num))
+			return false;
+		value = VisValue(num);
+	} else {
+		uint64_t num;
+		if (!parse_integer(token, num))
+			return false;
+		value = VisValue(num);
+	}
+	return true;
+}
+
+} // namespace
+
+bool VisValue::to_int(int64_t &out) const
+{
+	switch (type()) {
+	case Type::Int:
+		out = std::get<int64_t>(m_value);
+		return true;
+	case Type::UInt: {
+		uint64_t num = std::get<uint64_t>(m_value);
+		if (num > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+			return false;
+		out = static_cast<int64_t>(num);
+		return true;
+	}
+	case Type::Float: {
+		double num = std::trunc(std::get<double>(m_value));
+		if (!(num >= -9223372036854775808.0 && num < 9223372036854775808.0))
+			return false;
+		out = static_cast<int64_t>(num);
+		return true;
+	}
+	case Type::Bool:
+		out = std::get<bool>(m_value) ? 1 : 0;
+		return true;
+	case Type::String: {
+		VisValue num;
+		return parse_number(string(), num) && num.to_int(out);
+	}
+	default:
+		return false;
+	}
+}
+
+bool VisValue::to_uint(uint64_t &out) const
+{
+	if (type() == Type::UInt) {
+		out = std::get<uint64_t>(m_value);
+		return true;
+	}
+	int64_t num;
+	if (!to_int(num) || num < 0)
+		return false;
+	out = static_cast<uint64_t>(num);
+	return true;
+}
+
+bool VisValue::to_double(double &out) const
+{
+	switch (type()) {
+	case Type::Int:
+		out = static_cast<double>(std::get<int64_t>(m_value));
+		return true;
+	case Type::UInt:
+		out = static_cast<double>(std::get<uint64_t>(m_value));
+		return true;
+	case Type::Float:
+		out = std::get<double>(m_value);
+		return true;
+	case Type::Bool:
+		out = std::get<bool>(m_value) ? 1.0 : 0.0;
+		return true;
+	case Type::String:
+		return parse_double(string(), out);
+	default:
+		return false;
+	}
+}
+
+bool VisValue::to_bool(bool &out) const
+{
+	switch (type()) {
+	case Type::Bool:
+		out = std::get<bool>(m_value);
+		return true;
+	case Type::String: {
+		std::string_view s = string();
+		if (s == "true" || s == "false") {
+			out = (s == "true");
+			return true;
+		}
+		return false;
+	}
+	default: {
+		int64_t num;
+		if (!to_int(num))
+			return false;
+		out = (num != 0);
+		return true;
+	}
+	}
+}
+
+std::string_view VisValue::string() const
+{
+	if (type() == Type::String)
+		return std::get<std::string_view>(m_value);
+	return std::string_view();
+}
+
+bool VisValue::parse(std::string_view token, VisMessage::ValueKind kind)
+{
+	switch (kind) {
+	case VisMessage::ValueKind::String:
+		m_value = token;
+		return true;
+	case VisMessage::ValueKind::Bool:
+		m_value = (token == "true");
+		return true;
+	case VisMessage::ValueKind::Number:
+		return parse_number(token, *this);
+	default:
+		m_value = std::monostate();
+		return false;
+	}
+}
+
+bool VisValue::parse(const json &node)
+{
+	if (node.is_string()) {
+		m_value = std::string_view(node.get_ref<const std::string&>());
+	} else if (node.is_number_float()) {
+		m_value = node.get<double>();
+	} else if (node.is_number_unsigned()) {
+		m_value = node.get<uint64_t>();
+	} else if (node.is_number_integer()) {
+		m_value = node.get<int64_t>();
+	} else if (node.is_boolean()) {
+		m_value = node.get<bool>();
+	} else {
+		m_value = std::monostate();
+		return false;
+	}
+	return true;
+}
+
+template<typename T>
+static void append_number(std::string &out, T value)
+{
+	char buf[32];
+	auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	out.append(buf, result.ptr - buf);
+}
+
+void VisValue::append_json(std::string &out) const
+{
+	switch (type()) {
+	case Type::Int:
+		append_number(out, std::get<int64_t>(m_value));
+		break;
+	case Type::UInt:
+		append_number(out, std::get<uint64_t>(m_value));
+		break;
+	case Type::Float:
+		// JSON has no representation for nan or infinity
+		if (std::isfinite(std::get<double>(m_value)))
+			append_number(out, std::get<double>(m_value));
+		else
+			out.append("null");
+		break;
+	case Type::Bool:
+		out.append(std::get<bool>(m_value) ? "true" : "false");
+		break;
+	case Type::String:
+		append_json_string(out, std::get<std::string_view>(m_value));
+		break;
+	default:
+		out.append("null");
+		break;
+	}
+}
+
+std::ostream &operator<<(std::ostream &os, const VisValue &value)
+{
+	switch (value.type()) {
+	case VisValue::Type::Int:
+		return os << std::get<int64_t>(value.m_value);
+	case VisValue::Type::UInt:
+		return os << std::get<uint64_t>(value.m_value);
+	case VisValue::Type::Float:
+		return os << std::get<double>(value.m_value);
+	case VisValue::Type::Bool:
+		return os << (std::get<bool>(value.m_value) ? "true" : "false");
+	case VisValue::Type::String:
+		return os << std::get<std::string_view>(value.m_value);
+	default:
+		return os << "(none)";
+	}
+}
+
+void append_json_string(std::string &out, std::string_view s)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	out.push_back('"');
+	for (char c : s) {
+		switch (c) {
+		case '"':
+			out.append("\\\"");
+			break;
+		case '\\':
+			out.append("\\\\");
+			break;
+		case '\n':
+			out.append("\\n");
+			break;
+		case '\r':
+			out.append("\\r");
+			break;
+		case '\t':
+			out.append("\\t");
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				out.append("\\u00");
+				out.push_back(hex[(c >> 4) & 0xf]);
+				out.push_back(hex[c & 0xf]);
+			} else {
+				out.push_back(c);
+			}
+			break;
+		}
+	}
+	out.push_back('"');
+}
+
+static bool parse_digits(std::string_view ts, std::size_t pos, std::size_t len, int &out)
+{
+	if (pos + len > ts.size())
+		return false;
+	auto result = std::from_chars(ts.data() + pos, ts.data() + pos + len, out);
+	return result.ec == std::errc() && result.ptr == ts.data() + pos + len;
+}
+
+bool parse_timestamp(std::string_view ts, int64_t &nsec)
+{
+	int year, month, day, hour, minute, second;
+	if (!parse_digits(ts, 0, 4, year) || ts.size() < 19 || ts[4] != '-' ||
+	    !parse_digits(ts, 5, 2, month) || ts[7] != '-' ||
+	    !parse_digits(ts, 8, 2, day) || (ts[10] != 'T' && ts[10] != ' ') ||
+	    !parse_digits(ts, 11, 2, hour) || ts[13] != ':' ||
+	    !parse_digits(ts, 14, 2, minute) || ts[16] != ':' ||
+	    !parse_digits(ts, 17, 2, second) ||
+	    month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+		return false;
+
+	// Days since the epoch of the civil date
+	int y = year - (month <= 2);
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int64_t days = static_cast<int64_t>(era) * 146097 + doe - 719468;
+
+	int64_t secs = days * 86400 + hour * 3600 + minute * 60 + second;
+	int64_t frac = 0;
+	std::size_t pos = 19;
+	if (pos < ts.size() && ts[pos] == '.') {
+		int64_t scale = 100000000;
+		for (pos++; pos < ts.size() && ts[pos] >= '0' && ts[pos] <= '9'; pos++) {
+			frac += (ts[pos] - '0') * scale;
+			scale /= 10;
+		}
+	}
+
+	// Zone designator, a missing one is taken as UTC
+	if (pos < ts.size()) {
+		if (ts[pos] == 'Z' && pos + 1 == ts.size()) {
+			// UTC
+		} else if (ts[pos] == '+' || ts[pos] == '-') {
+			int zh, zm;
+			if (!parse_digits(ts, pos + 1, 2, zh) || pos + 6 != ts.size() || ts[pos + 3] != ':' ||
+			    !parse_digits(ts, pos + 4, 2, zm))
+				return false;
+			int64_t offset = zh * 3600 + zm * 60;
+			secs += ts[pos] == '+' ? -offset : offset;
+		} else {
+			return false;
+		}
+	}
+
+	nsec = secs * 1000000000 + frac;
+	return true;
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _VIS_VALUE_HPP
+#define _VIS_VALUE_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <nlohmann/json.hpp>
+#include "vis-decoder.hpp"
+
+using json = nlohmann::json;
+
+// Datapoint value typed by its JSON representation.  String values are views into the message
+// they were decoded from, so a VisValue must not outlive it.
+class VisValue
+{
+public:
+	// JSON type families, in variant index order.  VSS datatype
+	// ranges such as int8 or uint16 are not tracked here, signal
+	// mappings bound values through their min and max.
+	enum class Type { None, Int, UInt, Float, Bool, String };
+
+	VisValue() = default;
+	explicit VisValue(int64_t value) : m_value(value) {};
+	explicit VisValue(uint64_t value) : m_value(value) {};
+	explicit VisValue(double value) : m_value(value) {};
+	explicit VisValue(bool value) : m_value(value) {};
+	explicit VisValue(std::string_view value) : m_value(value) {};
+
+	Type type() const { return static_cast<Type>(m_value.index()); };
+	bool valid() const { return type() != Type::None; };
+
+	// Conversions for consumers, these fail rather than throw if
+	// the value cannot be represented.  Floats are truncated toward
+	// zero like a C cast, strings holding a number are parsed.
+	bool to_int(int64_t &out) const;
+	bool to_uint(uint64_t &out) const;
+	bool to_double(double &out) const;
+	bool to_bool(bool &out) const;
+	std::string_view string() const;
+
+	// Same type and value, strings compare by content
+	bool operator==(const VisValue &other) const { return m_value == other.m_value; };
+	bool operator!=(const VisValue &other) const { return m_value != other.m_value; };
+
+	// Builds a value from a raw token found by VisDecoder
+	bool parse(std::string_view token, VisMessage::ValueKind kind);
+
+	// Builds a value from a json DOM node, which must outlive it
+	bool parse(const json &node);
+
+	// Appends the value to out as a compact JSON token, non-finite
+	// floats become null
+	void append_json(std::string &out) const;
+
+	friend std::ostream &operator<<(std::ostream &os, const VisValue &value);
+
+private:
+	std::variant<std::monostate, int64_t, uint64_t, double, bool, std::string_view> m_value;
+};
+
+// Appends s to out as a quoted and escaped JSON string
+void append_json_string(std::string &out, std::string_view s);
+
+// Parses an ISO 8601 datapoint timestamp such as
+// "2023-04-01T12:34:56.789Z" or "...+02:00" into nanoseconds since the
+// epoch
+bool parse_timestamp(std::string_view ts, int64_t &nsec);
+
+#endif // _VIS_VALUE_HPP
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "check.hpp"
+#include "can-rx-publisher.hpp"
+
+// Offers value and lets the publisher handle it, without waiting for
+// any timer
+static void offer(net::io_context &ioc, CanRxPublisher &publisher, uint64_t value)
+{
+	publisher.offer(0, VisValue(value), 50);
+	publisher.flush();
+	ioc.restart();
+	ioc.poll();
+}
+
+// A value held back by min-interval, superseded by a repeat of the last
+// published one and then received again must still be published once
+// the interval is over
+static void test_held_after_clear()
+{
+	net::io_context ioc;
+	std::vector<uint64_t> published;
+	CanRxPublisher publisher(ioc, [&published](VisSignalId, const VisValue &value) {
+		uint64_t num = 0;
+		CHECK(value.to_uint(num));
+		published.push_back(num);
+	});
+
+	offer(ioc, publisher, 1);
+	CHECK(published == std::vector<uint64_t>({ 1 }));
+
+	offer(ioc, publisher, 2);	// held
+	offer(ioc, publisher, 1);	// same as published
+	offer(ioc, publisher, 2);	// held again
+	CHECK(published == std::vector<uint64_t>({ 1 }));
+
+	ioc.restart();
+	ioc.run();
+	CHECK(published == std::vector<uint64_t>({ 1, 2 }));
+}
+
+int main()
+{
+	test_held_after_clear();
+	return check_status();
+}
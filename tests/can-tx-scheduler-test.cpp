@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "check.hpp"
+#include "can-tx-scheduler.hpp"
+
+static void load_map(CanSignalMap &map, const char *mode)
+{
+	boost::property_tree::ptree pt;
+	pt.put("frame:test.id", "0x100");
+	pt.put("frame:test.dlc", "1");
+	pt.put("frame:test.mode", mode);
+	pt.put("frame:test.min-interval", "50");
+	pt.put("signal:test.path", "Test.Value");
+	pt.put("signal:test.frame", "0x100");
+	pt.put("signal:test.start-bit", "0");
+	pt.put("signal:test.length", "8");
+	CHECK(map.load(pt));
+	map.bind("Test.Value", 0);
+}
+
+// Encodes value and lets the scheduler handle it, without waiting for
+// any timer
+static void update(net::io_context &ioc, CanSignalMap &map, CanTxScheduler &scheduler, uint64_t value)
+{
+	CHECK(map.encode(0, VisValue(value)));
+	scheduler.notify();
+	ioc.restart();
+	ioc.poll();
+}
+
+// A change held back by min-interval, reverted before the timer fires
+// and then made again must still go out once the interval is over
+static void test_pending_after_clear()
+{
+	net::io_context ioc;
+	CanSignalMap map;
+	load_map(map, "on-change");
+	std::vector<uint8_t> sent;
+	CanTxScheduler scheduler(ioc, map, [&sent](const std::vector<struct can_frame> &frames) {
+		for (auto &frame : frames)
+			sent.push_back(frame.data[0]);
+	});
+
+	update(ioc, map, scheduler, 1);
+	CHECK(sent == std::vector<uint8_t>({ 1 }));
+
+	update(ioc, map, scheduler, 2);		// pending
+	update(ioc, map, scheduler, 1);		// back to what was sent
+	update(ioc, map, scheduler, 2);		// pending again
+	CHECK(sent == std::vector<uint8_t>({ 1 }));
+
+	ioc.restart();
+	ioc.run();
+	CHECK(sent == std::vector<uint8_t>({ 1, 2 }));
+}
+
+int main()
+{
+	test_pending_after_clear();
+	return check_status();
+}
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _CHECK_HPP
+#define _CHECK_HPP
+
+#include <iostream>
+
+// Minimal assertions for the unit tests, a failed check is reported and
+// turns the exit status of check_status() into a failure
+inline int g_check_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+			g_check_failures++; \
+		} \
+	} while (0)
+
+inline int check_status()
+{
+	return g_check_failures ? 1 : 0;
+}
+
+#endif // _CHECK_HPP
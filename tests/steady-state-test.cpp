@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+
+// Feeds a stream of notifications through the service, from the raw
+// message to the frames handed to the CAN socket, and fails if that
+// allocates once warmed up.
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <unistd.h>
+#include "check.hpp"
+#include "monitor-service.hpp"
+#include "handler-allocator.hpp"
+
+namespace fs = std::filesystem;
+
+// Counts every allocation made through operator new, kept out of line
+// like in the micro benchmarks
+static std::atomic<uint64_t> g_allocations{0};
+
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+class TestService : public MonitorService
+{
+public:
+	using MonitorService::MonitorService;
+	using MonitorService::handle_authorized_response;
+
+	// As if the server had answered the subscription requests
+	void bind_subscription(std::string_view path, std::string_view subscriptionId)
+	{
+		m_signals.bind_subscription(m_signals.find(path), subscriptionId);
+	};
+};
+
+// Notifications and set responses as read from the websocket, with
+// changing values
+static std::vector<std::string> notification_stream()
+{
+	std::vector<std::string> messages;
+	for (int i = 0; i < 100; i++) {
+		messages.push_back(R"({"action":"subscription","subscriptionId":"7f1c5a0e-3b6d-4f8e-9a2c-1d4b6e8f0a21",)"
+				   R"("ts":"2024-03-14T09:26:53.589793Z","data":{"path":"Vehicle.Speed",)"
+				   R"("dp":{"value":")" + std::to_string(i * 2.5) + R"(","ts":"2024-03-14T09:26:53.589653Z"}}})");
+		messages.push_back(R"({"action":"subscription","subscriptionId":"3e9a7d21-5c4b-4a8f-b6e2-0f1d2c3b4a59",)"
+				   R"("ts":"2024-03-14T09:26:53.590012Z","data":{"path":"Vehicle.TurboCharger.BoostLevel",)"
+				   R"("dp":{"value":)" + std::to_string(i) + R"(,"ts":"2024-03-14T09:26:53.589981Z"}}})");
+		messages.push_back(R"({"action":"set","requestId":")" + std::to_string(i) +
+				   R"(","ts":"2024-03-14T09:26:53.590127Z"})");
+	}
+	return messages;
+}
+
+// Replays the stream from io_context handlers as in the service,
+// returns the allocations made after the warmup
+static uint64_t steady_state_allocations(net::io_context &ioc, TestService &service)
+{
+	std::vector<std::string> messages = notification_stream();
+	std::size_t next = 0;
+	std::size_t warmup = 10 * messages.size();
+	std::size_t count = 10 * messages.size();
+	uint64_t start = 0;
+
+	HandlerMemory &memory = net::use_service<HandlerMemory>(ioc);
+	bool fed = false;
+
+	// Every other step only yields, so that what a message posted has
+	// run before the next one is fed
+	std::function<void()> step = [&]() {
+		fed = !fed;
+		if (!fed) {
+			net::post(ioc, make_handler(memory, [&step]() { step(); }));
+			return;
+		}
+		if (warmup) {
+			if (--warmup == 0)
+				start = g_allocations.load(std::memory_order_relaxed);
+		} else if (count-- == 0) {
+			// The service keeps work outstanding, e.g. the netlink
+			// socket, so run() does not return by itself
+			ioc.stop();
+			return;
+		}
+		service.replay(messages[next], realtime_ns());
+		next = (next + 1) % messages.size();
+		net::post(ioc, make_handler(memory, [&step]() { step(); }));
+	};
+
+	net::post(ioc, make_handler(memory, [&step]() { step(); }));
+	ioc.run();
+	return g_allocations.load(std::memory_order_relaxed) - start;
+}
+
+int main()
+{
+	// A small signal mapping on a CAN interface that does not exist,
+	// frames are assembled but not written
+	fs::path dir = fs::temp_directory_path() / ("agl-monitor-steady-state-test." + std::to_string(getpid()));
+	fs::create_directories(dir / "AGL");
+	std::ofstream config(dir / "AGL" / "agl-service-monitor.conf");
+	config << "[can]\n"
+	       << "port=test-none\n"
+	       << "verbose=0\n"
+	       << "\n[frame:speed]\nid=0x100\ndlc=8\n"
+	       << "\n[signal:speed]\npath=Vehicle.Speed\nframe=0x100\n"
+	       << "start-bit=0\nlength=16\nfactor=0.01\nmin=0\nmax=300\n"
+	       << "\n[frame:boost]\nid=0x201\ndlc=8\ndata=00 00 00 00 0B AD CA 78\n"
+	       << "\n[signal:boost-gauge]\npath=Vehicle.TurboCharger.BoostLevel\nframe=0x201\n"
+	       << "start-bit=8\nlength=8\nmin=0\nmax=99\ntable=0:50,79:129,80:170,100:210\n";
+	config.close();
+	setenv("XDG_CONFIG_HOME", dir.c_str(), 1);
+
+	{
+		net::io_context ioc;
+		ssl::context ctx{ssl::context::tlsv12_client};
+		VisConfig vis_config("localhost", 8090, "", "", "", "");
+		auto service = std::make_shared<TestService>(vis_config, ioc, ctx);
+		service->handle_authorized_response();
+		service->bind_subscription("Vehicle.Speed", "7f1c5a0e-3b6d-4f8e-9a2c-1d4b6e8f0a21");
+		service->bind_subscription("Vehicle.TurboCharger.BoostLevel",
+					   "3e9a7d21-5c4b-4a8f-b6e2-0f1d2c3b4a59");
+
+		uint64_t allocations = steady_state_allocations(ioc, *service);
+		if (allocations)
+			std::cerr << allocations << " allocations in the steady state" << std::endl;
+		CHECK(allocations == 0);
+	}
+
+	fs::remove_all(dir);
+	return check_status();
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "check.hpp"
+#include "vis-value.hpp"
+#include <limits>
+
+static void test_to_int()
+{
+	int64_t num = 0;
+
+	// Floats truncate toward zero, like the old conversion did
+	CHECK(VisValue(99.9).to_int(num) && num == 99);
+	CHECK(VisValue(-0.7).to_int(num) && num == 0);
+	CHECK(VisValue(-2.5).to_int(num) && num == -2);
+	CHECK(VisValue(std::string_view("79.5")).to_int(num) && num == 79);
+
+	CHECK(VisValue(int64_t(-8)).to_int(num) && num == -8);
+	CHECK(VisValue(true).to_int(num) && num == 1);
+	CHECK(!VisValue(uint64_t(1) << 63).to_int(num));
+	CHECK(!VisValue(1e19).to_int(num));
+	CHECK(!VisValue(std::string_view("speed")).to_int(num));
+}
+
+static void test_to_uint()
+{
+	uint64_t num = 0;
+
+	CHECK(VisValue(12.9).to_uint(num) && num == 12);
+	CHECK(!VisValue(int64_t(-1)).to_uint(num));
+}
+
+static std::string to_json(const VisValue &value)
+{
+	std::string out;
+	value.append_json(out);
+	return out;
+}
+
+static void test_append_json()
+{
+	CHECK(to_json(VisValue(int64_t(-3))) == "-3");
+	CHECK(to_json(VisValue(uint64_t(7))) == "7");
+	CHECK(to_json(VisValue(2.5)) == "2.5");
+	CHECK(to_json(VisValue(false)) == "false");
+	CHECK(to_json(VisValue(std::string_view("a\"b"))) == "\"a\\\"b\"");
+	CHECK(to_json(VisValue()) == "null");
+
+	// Neither nan nor infinity are valid JSON numbers
+	CHECK(to_json(VisValue(std::numeric_limits<double>::quiet_NaN())) == "null");
+	CHECK(to_json(VisValue(std::numeric_limits<double>::infinity())) == "null");
+	CHECK(to_json(VisValue(-std::numeric_limits<double>::infinity())) == "null");
+}
+
+int main()
+{
+	test_to_int();
+	test_to_uint();
+	test_append_json();
+	return check_status();
+}